@@ -12,14 +12,16 @@ void setup() {
 }
 
 void loop() {
-  // run the timer repeatedly, so that it resets itself and keeps going
+  // run the timer as a periodic timer, so that it re-arms itself every 2 seconds
   // but only if the counter's preset has not been reached.
   // use the timer's status bit TMR to trigger counting up.
   
   //update the timer. 
   //Timer has one input-- just enable.
-  //keep ours enabled as long as status bit on timer false, and status bit on counter false.
-  myTimer.update(!myCounter.CNT&&!myTimer.TMR);
+  //keep ours enabled as long as the status bit on the counter is false.
+  //TMR is true for one scan each period, and the next period is measured from
+  //the end of the previous one, so the time taken by loop() does not add up.
+  myTimer.updatePeriodic(!myCounter.CNT);
 
   //update the counter. 
   //counter has three inputs in_UP, in_DOWN, and RST in that order.
@@ -0,0 +1,47 @@
+#include <ME480FSM.h>
+
+//This program uses a timer on hardware Timer5 to produce a 20 microsecond
+//pulse on pin 13 once every half second.
+//The FSM has two states:
+//  Waiting for the half second timer
+//  Pulsing the output
+
+//create a millisecond timer with a duration of 500ms
+FSMTimer time500ms(500);
+//create a hardware timer on Timer5. The duration is set in setup(), after
+//the clock has been started and the ticks per microsecond are known.
+FSMHardwareTimer<5> pulseTimer(0);
+
+//declare the state variables
+bool stateWait;
+bool statePulse;
+
+void setup() {
+  // start Timer5 counting every CPU cycle (62.5ns per tick)
+  FSMHardwareClock<5>::begin(FSM_HWCLOCK_DIV1);
+  pulseTimer.duration = FSMHardwareClock<5>::microsToTicks(20);
+
+  pinMode(13, OUTPUT);
+  // initialize the states:
+  stateWait = true;
+  statePulse = false;
+}
+
+void loop() {
+  // Block 1 - handle timers
+  time500ms.update(stateWait);
+  pulseTimer.update(statePulse);
+
+  //Block 2 - transition logic
+  bool waitToPulse = stateWait && time500ms.TMR;
+  bool waitToWait = stateWait && !time500ms.TMR;
+  bool pulseToWait = statePulse && pulseTimer.TMR;
+  bool pulseToPulse = statePulse && !pulseTimer.TMR;
+
+  //Block 3 - Update States
+  stateWait = waitToWait || pulseToWait;
+  statePulse = waitToPulse || pulseToPulse;
+
+  //Block 4 - outputs
+  digitalWrite(13, statePulse);
+}
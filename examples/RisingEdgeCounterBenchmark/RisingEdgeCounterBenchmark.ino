@@ -0,0 +1,133 @@
+#include <ME480FSM.h>
+
+//This program checks the packed-state RisingEdgeCounter against the original
+//implementation, which kept every state and old input in its own bool, and then
+//measures how long one update takes with each of them.
+//Open the serial monitor at 115200 baud to see the results.
+
+//the original RisingEdgeCounter logic, kept here as the reference
+class ReferenceCounter
+{
+public:
+  ReferenceCounter(long _preset) {
+    preset = _preset;
+    state_Waiting = true;
+    state_Up = false;
+    state_Down = false;
+    state_RST = false;
+    in_Up_Old = false;
+    in_Down_Old = false;
+    count = 0;
+  }
+  void update(bool in_Up, bool in_Down, bool RST) {
+    //Block 1: unique presses on up, down, reset
+    bool upp = in_Up && !in_Up_Old;
+    bool dnp = in_Down && !in_Down_Old;
+
+    //Block 2: State Transition Logic.
+    bool waitToUp = state_Waiting && upp && !(dnp || RST);
+    bool waitToDown = state_Waiting && dnp && !(upp || RST);
+    bool waitToRST = state_Waiting && RST;
+    bool waitToWait = state_Waiting && !(waitToUp || waitToDown || waitToRST);
+    bool upToWait = state_Up;
+    bool upToRST = state_Up && RST;
+    bool downToWait = state_Down;
+    bool downToRST = state_Up && RST;
+    bool RSTToWait = state_RST&&!(RST);
+    bool RSTToRST = state_RST && !RSTToWait;
+
+    //Block 3: Update States
+    state_Waiting = upToWait||downToWait||RSTToWait||waitToWait;
+    state_Up = waitToUp;
+    state_Down = waitToDown;
+    state_RST = waitToRST||upToRST||downToRST||RSTToRST;
+
+    //Block 4: outputs and old variables
+    if(state_Up){
+      count++;
+    }
+    if(state_Down){
+      if(count>0) count--;
+    }
+    if (state_RST) {
+      count = 0;
+    }
+    CNT = (count >= preset);
+
+    in_Up_Old = in_Up;
+    in_Down_Old = in_Down;
+  }
+  long preset;
+  int count;
+  bool CNT;
+private:
+  bool state_Waiting;
+  bool state_Up;
+  bool state_Down;
+  bool state_RST;
+  bool in_Up_Old;
+  bool in_Down_Old;
+};
+
+#define NUM_STEPS 20000
+#define NUM_TIMED 1000
+#define NUM_INPUTS 128  //power of two, so the timed loops can wrap with a mask
+
+//inputs for the timed runs, so both counters see the same sequence
+bool upIn[NUM_INPUTS];
+bool downIn[NUM_INPUTS];
+bool rstIn[NUM_INPUTS];
+
+void setup() {
+  Serial.begin(115200);
+
+  //equivalence test: random inputs, with reset rare enough that counts build up
+  ReferenceCounter ref(5);
+  RisingEdgeCounter packed(5);
+  long mismatches = 0;
+  randomSeed(480);
+  for (long i = 0; i < NUM_STEPS; i++) {
+    bool up = random(2);
+    bool down = random(3) == 0;
+    bool rst = random(20) == 0;
+    ref.update(up, down, rst);
+    packed.update(up, down, rst);
+    if (ref.count != packed.count || ref.CNT != packed.CNT) mismatches++;
+  }
+  Serial.print("equivalence: ");
+  Serial.print(mismatches == 0 ? "PASS" : "FAIL");
+  Serial.print(" (");
+  Serial.print(mismatches);
+  Serial.println(" mismatches)");
+
+  //benchmark: time the same input sequence through both counters
+  for (int i = 0; i < NUM_INPUTS; i++) {
+    upIn[i] = random(2);
+    downIn[i] = random(4) == 0;
+    rstIn[i] = random(50) == 0;
+  }
+  unsigned long start = micros();
+  for (int i = 0; i < NUM_TIMED; i++) {
+    ref.update(upIn[i & (NUM_INPUTS - 1)], downIn[i & (NUM_INPUTS - 1)], rstIn[i & (NUM_INPUTS - 1)]);
+  }
+  unsigned long refTime = micros() - start;
+  start = micros();
+  for (int i = 0; i < NUM_TIMED; i++) {
+    packed.update(upIn[i & (NUM_INPUTS - 1)], downIn[i & (NUM_INPUTS - 1)], rstIn[i & (NUM_INPUTS - 1)]);
+  }
+  unsigned long packedTime = micros() - start;
+
+  Serial.print("reference: ");
+  Serial.print(refTime * 1000UL / NUM_TIMED);
+  Serial.print(" ns/update, ");
+  Serial.print(sizeof(ReferenceCounter));
+  Serial.println(" bytes");
+  Serial.print("packed:    ");
+  Serial.print(packedTime * 1000UL / NUM_TIMED);
+  Serial.print(" ns/update, ");
+  Serial.print(sizeof(RisingEdgeCounter));
+  Serial.println(" bytes");
+}
+
+void loop() {
+}
@@ -0,0 +1,23 @@
+/*! \file FSMHardwareClock1.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//upper 16 bits of the Timer1 clock. Kept in its own file, together with the interrupts,
+//so the Timer1 vectors are only linked into sketches that use FSMHardwareClock<1>
+template<> volatile uint16_t FSMHardwareClock<1>::overflows = 0;
+
+ISR(TIMER1_OVF_vect)
+{
+  FSMHardwareClock<1>::overflows++;
+}
+
+//compare A is only enabled while an FSMCallbackTimer<1> is running
+ISR(TIMER1_COMPA_vect)
+{
+  FSMCallbackTimer<1>::dispatch();
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*! \file FSMHardwareClock3.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//upper 16 bits of the Timer3 clock. Kept in its own file, together with the interrupts,
+//so the Timer3 vectors are only linked into sketches that use FSMHardwareClock<3>
+template<> volatile uint16_t FSMHardwareClock<3>::overflows = 0;
+
+ISR(TIMER3_OVF_vect)
+{
+  FSMHardwareClock<3>::overflows++;
+}
+
+//compare A is only enabled while an FSMCallbackTimer<3> is running
+ISR(TIMER3_COMPA_vect)
+{
+  FSMCallbackTimer<3>::dispatch();
+}
+
+#endif
@@ -0,0 +1,23 @@
+/*! \file FSMHardwareClock4.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//upper 16 bits of the Timer4 clock. Kept in its own file, together with the interrupts,
+//so the Timer4 vectors are only linked into sketches that use FSMHardwareClock<4>
+template<> volatile uint16_t FSMHardwareClock<4>::overflows = 0;
+
+ISR(TIMER4_OVF_vect)
+{
+  FSMHardwareClock<4>::overflows++;
+}
+
+//compare A is only enabled while an FSMCallbackTimer<4> is running
+ISR(TIMER4_COMPA_vect)
+{
+  FSMCallbackTimer<4>::dispatch();
+}
+
+#endif
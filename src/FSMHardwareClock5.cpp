@@ -0,0 +1,23 @@
+/*! \file FSMHardwareClock5.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//upper 16 bits of the Timer5 clock. Kept in its own file, together with the interrupts,
+//so the Timer5 vectors are only linked into sketches that use FSMHardwareClock<5>
+template<> volatile uint16_t FSMHardwareClock<5>::overflows = 0;
+
+ISR(TIMER5_OVF_vect)
+{
+  FSMHardwareClock<5>::overflows++;
+}
+
+//compare A is only enabled while an FSMCallbackTimer<5> is running
+ISR(TIMER5_COMPA_vect)
+{
+  FSMCallbackTimer<5>::dispatch();
+}
+
+#endif
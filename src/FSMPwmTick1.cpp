@@ -0,0 +1,19 @@
+/*! \file FSMPwmTick1.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//callback and dithered compare value of the Timer1 PWM tick. Kept in their own file, together with
+//the interrupt, so the Timer1 overflow vector is only linked into sketches that use FSMPwmTick<1>.
+//It cannot be used together with FSMHardwareClock<1>, which has its own overflow interrupt
+template<> void (*volatile FSMPwmTick<1>::callback)() = 0;
+template<> volatile uint16_t FSMPwmTick<1>::ditherBase = 0;
+
+ISR(TIMER1_OVF_vect)
+{
+  FSMPwmTick<1>::dispatch();
+}
+
+#endif
@@ -0,0 +1,19 @@
+/*! \file FSMPwmTick3.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//callback and dithered compare value of the Timer3 PWM tick. Kept in their own file, together with
+//the interrupt, so the Timer3 overflow vector is only linked into sketches that use FSMPwmTick<3>.
+//It cannot be used together with FSMHardwareClock<3>, which has its own overflow interrupt
+template<> void (*volatile FSMPwmTick<3>::callback)() = 0;
+template<> volatile uint16_t FSMPwmTick<3>::ditherBase = 0;
+
+ISR(TIMER3_OVF_vect)
+{
+  FSMPwmTick<3>::dispatch();
+}
+
+#endif
@@ -0,0 +1,19 @@
+/*! \file FSMPwmTick4.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//callback and dithered compare value of the Timer4 PWM tick. Kept in their own file, together with
+//the interrupt, so the Timer4 overflow vector is only linked into sketches that use FSMPwmTick<4>.
+//It cannot be used together with FSMHardwareClock<4>, which has its own overflow interrupt
+template<> void (*volatile FSMPwmTick<4>::callback)() = 0;
+template<> volatile uint16_t FSMPwmTick<4>::ditherBase = 0;
+
+ISR(TIMER4_OVF_vect)
+{
+  FSMPwmTick<4>::dispatch();
+}
+
+#endif
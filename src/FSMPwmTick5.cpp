@@ -0,0 +1,19 @@
+/*! \file FSMPwmTick5.cpp */
+
+#include "Arduino.h"
+#include "ME480FSM.h"
+
+#ifdef FSM_HAS_TIMER16
+
+//callback and dithered compare value of the Timer5 PWM tick. Kept in their own file, together with
+//the interrupt, so the Timer5 overflow vector is only linked into sketches that use FSMPwmTick<5>.
+//It cannot be used together with FSMHardwareClock<5>, which has its own overflow interrupt
+template<> void (*volatile FSMPwmTick<5>::callback)() = 0;
+template<> volatile uint16_t FSMPwmTick<5>::ditherBase = 0;
+
+ISR(TIMER5_OVF_vect)
+{
+  FSMPwmTick<5>::dispatch();
+}
+
+#endif
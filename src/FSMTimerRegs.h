@@ -0,0 +1,146 @@
+/*! \file FSMTimerRegs.h */
+/*!
+ * @file FSMTimerRegs.h
+ *
+ * Compile-time access to the 16-bit hardware timers and the I/O ports of the ATmega1280/2560
+ * (Arduino Mega). The classes in ME480FSM.h that run directly on a hardware timer or port are
+ * templated on the timer number or pin numbers and use these definitions so that every
+ * register access compiles down to a single load or store.
+ */
+
+#ifndef FSMTimerRegs_h
+#define FSMTimerRegs_h
+
+#include "Arduino.h"
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define FSM_HAS_TIMER16 1   ///<Defined when Timer1, Timer3, Timer4 and Timer5 are available
+#endif
+
+#ifdef FSM_HAS_TIMER16
+
+/*!
+ @brief  Register map of one of the 16-bit timers (1, 3, 4 or 5)
+
+ FSMTimerRegs<n> is only defined for the timers that exist on the processor, so using an
+ invalid timer number is a compile error. The bit positions are the same for all four
+ timers and are provided as constants so templated code does not need the numbered names.
+*/
+template<uint8_t TimerNum> struct FSMTimerRegs;
+
+#define FSM_TIMER_REGS(n)                                                 \
+template<> struct FSMTimerRegs<n>                                         \
+{                                                                         \
+  static volatile uint8_t &tccra() { return TCCR##n##A; }                 \
+  static volatile uint8_t &tccrb() { return TCCR##n##B; }                 \
+  static volatile uint8_t &tccrc() { return TCCR##n##C; }                 \
+  static volatile uint16_t &tcnt() { return TCNT##n; }                    \
+  static volatile uint16_t &ocra() { return OCR##n##A; }                  \
+  static volatile uint16_t &ocrb() { return OCR##n##B; }                  \
+  static volatile uint16_t &ocrc() { return OCR##n##C; }                  \
+  static volatile uint16_t &icr() { return ICR##n; }                      \
+  static volatile uint16_t &ocr(uint8_t ch)                               \
+    { return ch == 0 ? OCR##n##A : (ch == 1 ? OCR##n##B : OCR##n##C); }   \
+  static volatile uint8_t &timsk() { return TIMSK##n; }                   \
+  static volatile uint8_t &tifr() { return TIFR##n; }                     \
+  static const uint8_t TOV = TOV##n;                                      \
+  static const uint8_t OCFA = OCF##n##A;                                  \
+  static const uint8_t TOIE = TOIE##n;                                    \
+  static const uint8_t OCIEA = OCIE##n##A;                                \
+  static const uint8_t WGM1 = WGM##n##1;                                  \
+  static const uint8_t WGM3 = WGM##n##3;                                  \
+  static const uint8_t CS0 = CS##n##0;                                    \
+};
+
+FSM_TIMER_REGS(1)
+FSM_TIMER_REGS(3)
+FSM_TIMER_REGS(4)
+FSM_TIMER_REGS(5)
+
+#undef FSM_TIMER_REGS
+
+//compare output bits (COMnx1) of channel ch (0 = A, 1 = B, 2 = C), the same for all four timers
+constexpr uint8_t fsmComBit(uint8_t ch) { return 1 << (7 - 2 * ch); }
+
+//16-bit timer PWM pins of the Arduino Mega, as (timer << 4) | channel; 0 for other pins
+constexpr uint8_t fsmPwmPin(uint8_t pin)
+{
+  return pin == 2 ? 0x31 : pin == 3 ? 0x32 : pin == 5 ? 0x30 :
+         pin == 6 ? 0x40 : pin == 7 ? 0x41 : pin == 8 ? 0x42 :
+         pin == 11 ? 0x10 : pin == 12 ? 0x11 :
+         pin == 44 ? 0x52 : pin == 45 ? 0x51 : pin == 46 ? 0x50 : 0;
+}
+
+//timer number and compare channel of a PWM pin
+constexpr uint8_t fsmPwmTimer(uint8_t pin) { return fsmPwmPin(pin) >> 4; }
+constexpr uint8_t fsmPwmChannel(uint8_t pin) { return fsmPwmPin(pin) & 0x0F; }
+
+//port numbers used by fsmPinPort()
+#define FSM_PORT_A 0
+#define FSM_PORT_B 1
+#define FSM_PORT_C 2
+#define FSM_PORT_D 3
+#define FSM_PORT_E 4
+#define FSM_PORT_F 5
+#define FSM_PORT_G 6
+#define FSM_PORT_H 7
+#define FSM_PORT_J 8
+#define FSM_PORT_K 9
+#define FSM_PORT_L 10
+
+#define FSM_PIN(port, bit) ((FSM_PORT_##port << 3) | (bit))
+
+//port and bit of each Arduino Mega pin number, as FSM_PIN(port, bit)
+static constexpr uint8_t fsmMegaPins[70] = {
+  FSM_PIN(E, 0), FSM_PIN(E, 1), FSM_PIN(E, 4), FSM_PIN(E, 5), FSM_PIN(G, 5),  //0-4
+  FSM_PIN(E, 3), FSM_PIN(H, 3), FSM_PIN(H, 4), FSM_PIN(H, 5), FSM_PIN(H, 6),  //5-9
+  FSM_PIN(B, 4), FSM_PIN(B, 5), FSM_PIN(B, 6), FSM_PIN(B, 7),                 //10-13
+  FSM_PIN(J, 1), FSM_PIN(J, 0), FSM_PIN(H, 1), FSM_PIN(H, 0),                 //14-17
+  FSM_PIN(D, 3), FSM_PIN(D, 2), FSM_PIN(D, 1), FSM_PIN(D, 0),                 //18-21
+  FSM_PIN(A, 0), FSM_PIN(A, 1), FSM_PIN(A, 2), FSM_PIN(A, 3),                 //22-25
+  FSM_PIN(A, 4), FSM_PIN(A, 5), FSM_PIN(A, 6), FSM_PIN(A, 7),                 //26-29
+  FSM_PIN(C, 7), FSM_PIN(C, 6), FSM_PIN(C, 5), FSM_PIN(C, 4),                 //30-33
+  FSM_PIN(C, 3), FSM_PIN(C, 2), FSM_PIN(C, 1), FSM_PIN(C, 0),                 //34-37
+  FSM_PIN(D, 7), FSM_PIN(G, 2), FSM_PIN(G, 1), FSM_PIN(G, 0),                 //38-41
+  FSM_PIN(L, 7), FSM_PIN(L, 6), FSM_PIN(L, 5), FSM_PIN(L, 4),                 //42-45
+  FSM_PIN(L, 3), FSM_PIN(L, 2), FSM_PIN(L, 1), FSM_PIN(L, 0),                 //46-49
+  FSM_PIN(B, 3), FSM_PIN(B, 2), FSM_PIN(B, 1), FSM_PIN(B, 0),                 //50-53
+  FSM_PIN(F, 0), FSM_PIN(F, 1), FSM_PIN(F, 2), FSM_PIN(F, 3),                 //54-57 (A0-A3)
+  FSM_PIN(F, 4), FSM_PIN(F, 5), FSM_PIN(F, 6), FSM_PIN(F, 7),                 //58-61 (A4-A7)
+  FSM_PIN(K, 0), FSM_PIN(K, 1), FSM_PIN(K, 2), FSM_PIN(K, 3),                 //62-65 (A8-A11)
+  FSM_PIN(K, 4), FSM_PIN(K, 5), FSM_PIN(K, 6), FSM_PIN(K, 7)                  //66-69 (A12-A15)
+};
+
+#undef FSM_PIN
+
+//port number and bit mask of an Arduino Mega pin, usable in constant expressions
+constexpr uint8_t fsmPinPort(uint8_t pin) { return fsmMegaPins[pin] >> 3; }
+constexpr uint8_t fsmPinMask(uint8_t pin) { return 1 << (fsmMegaPins[pin] & 7); }
+
+/*!
+ @brief  Input register of an I/O port, by the port numbers returned by fsmPinPort()
+*/
+template<uint8_t Port> struct FSMPortRegs;
+
+#define FSM_PORT_REGS(x)                                                  \
+template<> struct FSMPortRegs<FSM_PORT_##x>                               \
+{                                                                         \
+  static volatile uint8_t &pin() { return PIN##x; }                       \
+};
+
+FSM_PORT_REGS(A)
+FSM_PORT_REGS(B)
+FSM_PORT_REGS(C)
+FSM_PORT_REGS(D)
+FSM_PORT_REGS(E)
+FSM_PORT_REGS(F)
+FSM_PORT_REGS(G)
+FSM_PORT_REGS(H)
+FSM_PORT_REGS(J)
+FSM_PORT_REGS(K)
+FSM_PORT_REGS(L)
+
+#undef FSM_PORT_REGS
+
+#endif //FSM_HAS_TIMER16
+#endif
@@ -2,6 +2,7 @@
 
 #include "Arduino.h"
 #include "ME480FSM.h"
+#include <avr/eeprom.h>
 
 
 
@@ -23,12 +24,7 @@ RisingEdgeCounter::RisingEdgeCounter(long _preset)
     //when we create our counter, the only unique thing is the preset.
     //set initial values for all other variables we need as necessary here as well.
     preset = _preset;
-    state_Waiting = true;
-    state_Up = false;
-    state_Down = false;
-    state_RST = false;
-    in_Up_Old = false;
-    in_Down_Old = false;
+    state = FSM_CNT_WAITING;  //waiting, with in_Up and in_Down saved as false
     count = 0;
 }
 
@@ -59,44 +55,257 @@ RisingEdgeCounter::~RisingEdgeCounter(){}
    not change the count and waits for the next false-true transition
  */
 void RisingEdgeCounter::update(bool in_Up,bool in_Down,bool RST){
-    //Block 1: unique presses on up, down, reset
-    bool upp = in_Up && !in_Up_Old;
-    bool dnp = in_Down && !in_Down_Old;
-
-
-    //Block 2: State Transition Logic.
-    //note all of these are local, since they don't need to be "remembered"
-    bool waitToUp = state_Waiting && upp && !(dnp || RST);
-    bool waitToDown = state_Waiting && dnp && !(upp || RST);
-    bool waitToRST = state_Waiting && RST;
-    bool waitToWait = state_Waiting && !(waitToUp || waitToDown || waitToRST);
-    bool upToWait = state_Up;
-    bool upToRST = state_Up && RST;
-    bool downToWait = state_Down;
-    bool downToRST = state_Up && RST;
-    bool RSTToWait = state_RST&&!(RST);
-    bool RSTToRST = state_RST && !RSTToWait;
+    //fast path: waiting with unchanged inputs and no reset, so the state and count stay the same
+    if(!RST && state==fsmCounterIdle(in_Up,in_Down)){
+      CNT = (count >= preset);
+      return;
+    }
 
-    //Block 3: Update States
-    state_Waiting = upToWait||downToWait||RSTToWait||waitToWait;
-    state_Up = waitToUp;
-    state_Down = waitToDown;
-    state_RST = waitToRST||upToRST||downToRST||RSTToRST;
+    //Blocks 1-3: unique presses and state transitions on the packed state
+    state = fsmCounterStep(state, in_Up, in_Down, RST);
 
-    //Block 4: outputs and old variables
-    if(state_Up){
+    //Block 4: outputs (the old variables are saved in the state)
+    if(state & FSM_CNT_UP){
       count++;
     }
-    if(state_Down){
+    if(state & FSM_CNT_DOWN){
       if(count>0) count--;
     }
-    if (state_RST) {
+    if (state & FSM_CNT_RST) {
       count = 0;
     }
     CNT = (count >= preset);
+}
 
-    in_Up_Old = in_Up;
-    in_Down_Old = in_Down;
+/*!
+   @brief   This function runs when you "construct" a cam counter
+
+   @return  CamCounter object.
+   @param   _thresholds (const long array) thresholds sorted from lowest to highest
+   @param   _numThresholds (uint8_t) number of thresholds, at most 32
+ */
+CamCounter::CamCounter(const long *_thresholds, uint8_t _numThresholds) : RisingEdgeCounter(0)
+{
+    thresholds = _thresholds;
+    numThresholds = (_numThresholds > 32) ? 32 : _numThresholds;
+    if (numThresholds > 0) preset = thresholds[numThresholds - 1];
+    crossed = 0;
+    numCrossed = 0;
+    track();
+    CNT = (count >= preset);
+}
+
+/*!
+   @brief   This function updates the counter and the crossed thresholds.
+
+   The counter works like RisingEdgeCounter::update. The crossed bits are only updated when the count changes.
+
+   @return  nothing
+
+   @param   in_Up (bool) a false to true transition in this variable will increment the counter
+   @param   in_Down (bool) a false to true transition in this variable will decrement the counter
+   @param   RST (bool) true will reset the counter to 0, does not need a false to true transition
+ */
+void CamCounter::update(bool in_Up, bool in_Down, bool RST){
+    RisingEdgeCounter::update(in_Up, in_Down, RST);
+    if(state & (FSM_CNT_UP | FSM_CNT_DOWN | FSM_CNT_RST)){
+        track();
+    }
+}
+
+//moves numCrossed to the thresholds around the current count, comparing only with its neighbours
+void CamCounter::track(){
+    while(numCrossed < numThresholds && count >= thresholds[numCrossed]){
+        crossed |= (1UL << numCrossed);
+        numCrossed++;
+    }
+    while(numCrossed > 0 && count < thresholds[numCrossed - 1]){
+        numCrossed--;
+        crossed &= ~(1UL << numCrossed);
+    }
+}
+
+/*!
+   @brief   This function runs when you "construct" a rate counter
+
+   @return  RateCounter object.
+   @param   _preset (long) Sets the preset count when the state of the counter changes
+   @param   _window (unsigned long) gate time in milliseconds, or the timeout in reciprocal mode
+   @param   _mode (uint8_t) FSM_RATE_GATED or FSM_RATE_RECIPROCAL
+ */
+RateCounter::RateCounter(long _preset, unsigned long _window, uint8_t _mode) : RisingEdgeCounter(_preset)
+{
+    window = _window;
+    mode = _mode;
+    rate = 0;
+    edges = 0;
+    haveEdge = false;
+    lastTime = (mode == FSM_RATE_GATED) ? millis() : micros();
+}
+
+/*!
+   @brief   This function updates the counter and the rate measurement.
+
+   The counter works like RisingEdgeCounter::update. Each up count is also used to measure the rate.
+   A reset clears the count but not the rate.
+
+   @return  nothing
+
+   @param   in_Up (bool) a false to true transition in this variable will increment the counter
+   @param   in_Down (bool) a false to true transition in this variable will decrement the counter
+   @param   RST (bool) true will reset the counter to 0, does not need a false to true transition
+ */
+void RateCounter::update(bool in_Up, bool in_Down, bool RST){
+    RisingEdgeCounter::update(in_Up, in_Down, RST);
+    bool counted = state & FSM_CNT_UP;
+
+    if(mode == FSM_RATE_GATED){
+        unsigned long curTime = millis();
+        unsigned long gate = curTime - lastTime;
+        if(counted) edges++;
+        if(gate >= window && gate > 0){
+            //divide by the real gate time, which can be longer than window by one scan
+            if(edges <= 16777) rate = (edges * 256000UL) / gate;
+            else rate = (unsigned long)(((unsigned long long)edges * 256000UL) / gate);
+            edges = 0;
+            lastTime = curTime;
+        }
+    }
+    else{
+        unsigned long curTime = micros();
+        if(counted){
+            unsigned long period = curTime - lastTime;
+            if(haveEdge && period > 0) rate = 256000000UL / period;
+            lastTime = curTime;
+            haveEdge = true;
+        }
+        else if(haveEdge && curTime - lastTime >= window * 1000UL){
+            rate = 0;
+            haveEdge = false;
+        }
+    }
+}
+
+/*!
+   @brief   This function runs when you "construct" a persistent value
+
+   The slots are read to find the newest complete save, which is restored into value (0 if there is none).
+
+   @return  FSMPersistentValue object.
+   @param   _baseAddress (unsigned int) EEPROM address of the first slot
+   @param   _slots (uint8_t) number of slots, each FSM_PERSIST_RECORD bytes long (2 to 255)
+   @param   _minInterval (unsigned long) least time in milliseconds between the start of two saves
+ */
+FSMPersistentValue::FSMPersistentValue(unsigned int _baseAddress, uint8_t _slots, unsigned long _minInterval)
+{
+    baseAddress = _baseAddress;
+    slots = (_slots < 2) ? 2 : _slots;
+    minInterval = _minInterval;
+    BUSY = false;
+    written = FSM_PERSIST_RECORD;
+    lastSave = millis();
+    value = 0;
+
+    //the newest slot is the one whose sequence number is not followed by the next number
+    slot = slots - 1;
+    uint8_t prev = eeprom_read_byte((const uint8_t *)(slotAddress(0) + FSM_PERSIST_RECORD - 1));
+    for(uint8_t i = 0; i < slots - 1; i++){
+        uint8_t next = eeprom_read_byte((const uint8_t *)(slotAddress(i + 1) + FSM_PERSIST_RECORD - 1));
+        if(next != (uint8_t)(prev + 1)){
+            slot = i;
+            break;
+        }
+        prev = next;
+    }
+
+    //restore the newest slot, or the one before it if its write was cut off
+    for(uint8_t tries = 0; tries < 2; tries++){
+        uint8_t s = (slot + slots - tries) % slots;
+        eeprom_read_block(record, (const void *)slotAddress(s), FSM_PERSIST_RECORD);
+        if(record[4] == check(record)){
+            value = (int32_t)((uint32_t)record[0] | ((uint32_t)record[1] << 8) |
+                              ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 24));
+            break;
+        }
+    }
+    //the next save follows the newest slot, even if it was not valid
+    seq = eeprom_read_byte((const uint8_t *)(slotAddress(slot) + FSM_PERSIST_RECORD - 1));
+}
+
+//check byte of a record, covering the value and the sequence number
+uint8_t FSMPersistentValue::check(const uint8_t *record){
+    return record[0] ^ record[1] ^ record[2] ^ record[3] ^ record[5] ^ 0xA5;
+}
+
+/*!
+   @brief   This function saves a value to EEPROM in the background
+
+   A save of _value starts when it differs from the saved value, no save is in progress and minInterval has
+   passed since the last save. Each call then writes at most one byte, when the EEPROM is ready, so the
+   call never waits. Bytes that already hold the right value are not rewritten.
+
+   @return  nothing
+
+   @param   _value (long) current value to keep
+ */
+void FSMPersistentValue::update(long _value){
+    if(!BUSY){
+        if(_value == value || millis() - lastSave < minInterval) return;
+        //Start a save in the next slot; the sequence number goes last so the slot is only used once complete
+        value = _value;
+        slot = (slot + 1) % slots;
+        seq++;
+        record[0] = (uint8_t)_value;
+        record[1] = (uint8_t)((unsigned long)_value >> 8);
+        record[2] = (uint8_t)((unsigned long)_value >> 16);
+        record[3] = (uint8_t)((unsigned long)_value >> 24);
+        record[5] = seq;
+        record[4] = check(record);
+        written = 0;
+        lastSave = millis();
+        BUSY = true;
+    }
+    if(!eeprom_is_ready()) return;
+    uint8_t *address = (uint8_t *)(slotAddress(slot) + written);
+    if(eeprom_read_byte(address) != record[written]){
+        eeprom_write_byte(address, record[written]);
+    }
+    written++;
+    BUSY = (written < FSM_PERSIST_RECORD);
+}
+
+/*!
+   @brief   This function runs when you "construct" a persistent counter
+
+   The count is restored from EEPROM.
+
+   @return  PersistentCounter object.
+   @param   _preset (long) Sets the preset count when the state of the counter changes
+   @param   _baseAddress (unsigned int) EEPROM address of the first slot
+   @param   _slots (uint8_t) number of slots, each FSM_PERSIST_RECORD bytes long
+   @param   _minInterval (unsigned long) least time in milliseconds between the start of two saves
+ */
+PersistentCounter::PersistentCounter(long _preset, unsigned int _baseAddress, uint8_t _slots, unsigned long _minInterval)
+    : RisingEdgeCounter(_preset), store(_baseAddress, _slots, _minInterval)
+{
+    count = (int)store.value;
+    CNT = (count >= preset);
+}
+
+/*!
+   @brief   This function updates the counter and saves the count when it has changed
+
+   The counter works like RisingEdgeCounter::update.
+
+   @return  nothing
+
+   @param   in_Up (bool) a false to true transition in this variable will increment the counter
+   @param   in_Down (bool) a false to true transition in this variable will decrement the counter
+   @param   RST (bool) true will reset the counter to 0, does not need a false to true transition
+ */
+void PersistentCounter::update(bool in_Up, bool in_Down, bool RST){
+    RisingEdgeCounter::update(in_Up, in_Down, RST);
+    store.update(count);
 }
 
 /*!
@@ -132,13 +341,20 @@ FSMTimer::~FSMTimer() {}
 
    If enable is true the timer checks to see if the elapsed time is greater than the preset duration and sets the 
    TMR value<br>
-   If enable is false the timer resets 
+   If enable is false the timer resets
 
    @return  nothing
 
    @param   enable (bool) a turns the timer on or off
  */
 void FSMTimer::update(bool enable){
+    //fast path: a disabled timer that is already waiting does not change, so the clock is not read
+    if(state_Waiting &&! enable){
+        elapsed = 0;
+        TMR = (duration==0);
+        return;
+    }
+
     //Block 1: nothing needed, since enable has been passed from 
     //main program!!
 
@@ -155,13 +371,65 @@ void FSMTimer::update(bool enable){
 
     //Block 4: outputs and old variables
     unsigned long curTime = millis();
-    if(state_Waiting){
-        startTime = curTime;
+    if(state_Waiting || waitToTime){
+        startTime = curTime;  //timing starts on the scan the timer is enabled
     }
     elapsed = curTime-startTime;
     TMR = (elapsed>=duration);
 }
 
+/*!
+   @brief   This function updates the timer as a fixed-rate periodic timer.
+
+   The timer works like update(), except that when the elapsed time reaches the duration, TMR is true
+   for that one call and the timer re-arms itself by advancing its start time by exactly one duration.
+   The period therefore does not pick up the scan time of loop(), and the average rate stays exact.
+   If loop() fell behind by more than a whole period, the missed periods are skipped and counted.<br>
+   If enable is false the timer resets
+
+   @return  the number of whole periods that were missed (0 when the timer is updated often enough)
+
+   @param   enable (bool) a turns the timer on or off
+ */
+unsigned long FSMTimer::updatePeriodic(bool enable){
+    //fast path: a disabled timer that is already waiting does not change
+    if(state_Waiting &&! enable){
+        elapsed = 0;
+        TMR = (duration==0);
+        return 0;
+    }
+
+    //Block 2: State Transition Logic.
+    bool waitToTime = state_Waiting && enable;
+    bool waitToWait = state_Waiting &&! enable;
+    bool timeToWait = state_Timing &&! enable;
+    bool timeToTime = state_Timing && enable;
+
+    //Block 3: Update States
+    state_Waiting = timeToWait||waitToWait;
+    state_Timing = waitToTime||timeToTime;
+
+    //Block 4: outputs and old variables
+    unsigned long curTime = millis();
+    unsigned long missed = 0;
+    if(state_Waiting || waitToTime){
+        startTime = curTime;  //timing starts on the scan the timer is enabled
+    }
+    elapsed = curTime-startTime;
+    TMR = (elapsed>=duration);
+    if(TMR && state_Timing && duration>0){
+        //re-arm one period after the previous deadline, not after now
+        startTime += duration;
+        elapsed -= duration;
+        if(elapsed>=duration){
+            missed = elapsed/duration;
+            startTime += missed*duration;
+            elapsed -= missed*duration;
+        }
+    }
+    return missed;
+}
+
 /*!
    @brief   This function runs when you "construct" a fast timer
 
@@ -202,6 +470,13 @@ FSMFastTimer::~FSMFastTimer() {}
    @param   enable (bool) a turns the timer on or off
  */
 void FSMFastTimer::update(bool enable) {
+  //fast path: a disabled timer that is already waiting does not change, so the clock is not read
+  if (state_Waiting && !enable) {
+    elapsed = 0;
+    TMR = (duration == 0);
+    return;
+  }
+
   //Block 1: nothing needed, since enable has been passed from 
   //main program!!
 
@@ -218,13 +493,65 @@ void FSMFastTimer::update(bool enable) {
 
   //Block 4: outputs and old variables
   unsigned long curTime = micros();
-  if (state_Waiting) {
-    startTime = curTime;
+  if (state_Waiting || waitToTime) {
+    startTime = curTime;  //timing starts on the scan the timer is enabled
   }
   elapsed = curTime - startTime;
   TMR = (elapsed >= duration);
 }
 
+/*!
+   @brief   This function updates the timer as a fixed-rate periodic timer.
+
+   The timer works like update(), except that when the elapsed time reaches the duration, TMR is true
+   for that one call and the timer re-arms itself by advancing its start time by exactly one duration.
+   The period therefore does not pick up the scan time of loop(), and the average rate stays exact.
+   If loop() fell behind by more than a whole period, the missed periods are skipped and counted.<br>
+   If enable is false the timer resets
+
+   @return  the number of whole periods that were missed (0 when the timer is updated often enough)
+
+   @param   enable (bool) a turns the timer on or off
+ */
+unsigned long FSMFastTimer::updatePeriodic(bool enable) {
+  //fast path: a disabled timer that is already waiting does not change
+  if (state_Waiting && !enable) {
+    elapsed = 0;
+    TMR = (duration == 0);
+    return 0;
+  }
+
+  //Block 2: State Transition Logic.
+  bool waitToTime = state_Waiting && enable;
+  bool waitToWait = state_Waiting && !enable;
+  bool timeToWait = state_Timing && !enable;
+  bool timeToTime = state_Timing && enable;
+
+  //Block 3: Update States
+  state_Waiting = timeToWait || waitToWait;
+  state_Timing = waitToTime || timeToTime;
+
+  //Block 4: outputs and old variables
+  unsigned long curTime = micros();
+  unsigned long missed = 0;
+  if (state_Waiting || waitToTime) {
+    startTime = curTime;  //timing starts on the scan the timer is enabled
+  }
+  elapsed = curTime - startTime;
+  TMR = (elapsed >= duration);
+  if (TMR && state_Timing && duration > 0) {
+    //re-arm one period after the previous deadline, not after now
+    startTime += duration;
+    elapsed -= duration;
+    if (elapsed >= duration) {
+      missed = elapsed / duration;
+      startTime += missed * duration;
+      elapsed -= missed * duration;
+    }
+  }
+  return missed;
+}
+
 
 //Encoder code**********************************************
 
@@ -488,77 +815,63 @@ long FSMEncoder2::getCountsAndReset()
   return counts;
 }
 
-#define MOTOR2_IN1_PIN 6
-#define MOTOR2_IN2_PIN 8
 
-/*! @brief This is the constructor for the class.
-
-It will initialize the output pins and set the motor to 0 volts. This is called automatically
-when you declare the objectand will not need to be call in your program. You should not set the
-pinMode of the motor pins in your program.
-*/
-FSMMotor2::FSMMotor2() {
-  {
-    if (!initialized) {
-
-      pinMode(MOTOR2_IN1_PIN, OUTPUT);
-      pinMode(MOTOR2_IN2_PIN, OUTPUT);
+#ifdef FSM_HAS_TIMER16
 
-      curVoltageCounts = 0;
-      analogWrite(MOTOR2_IN1_PIN, 255);
-      analogWrite(MOTOR2_IN2_PIN, 255);
+/*!
+   @brief   This function runs when you "construct" a supply voltage measurement
 
-      initialized = true;
-    }
-  }
+   @return  FSMSupplySense object.
+   @param   _pin (uint8_t) analog pin of the voltage divider (A0 to A15)
+   @param   _fullScaleMillivolts (unsigned int) supply voltage in millivolts that gives an ADC reading of 1023
+   @param   _samplePeriod (unsigned long) time in milliseconds between samples
+ */
+FSMSupplySense::FSMSupplySense(uint8_t _pin, unsigned int _fullScaleMillivolts, unsigned long _samplePeriod)
+{
+    pin = (_pin >= A0) ? _pin - A0 : _pin;
+    mvPerCountQ16 = (((unsigned long)_fullScaleMillivolts << 16) + 511) / 1023;
+    samplePeriod = _samplePeriod;
+    millivolts = 0;
+    recipQ10 = 0;
+    BUSY = false;
+    lastSample = 0;
 }
 
+/*!
+   @brief   This function starts a conversion when one is due and collects it when it has finished
 
-/*! @brief This is the destructor for the class.
-
-It will return the output pins for motor 2 (6 & 8) to INPUT mode.
-*/
-FSMMotor2::~FSMMotor2() {
-  {
-    if (initialized) {
-
-      analogWrite(MOTOR2_IN1_PIN, 0);
-      analogWrite(MOTOR2_IN2_PIN, 0);
-
-      pinMode(MOTOR2_IN1_PIN, INPUT);
-      pinMode(MOTOR2_IN2_PIN, INPUT);
+   It never waits for the ADC. The division for the reciprocal is done here, once per sample.
+   If the ADC no longer selects the supply pin when the conversion has finished, an analogRead() of another
+   pin has run in between and the result in ADC is not the supply voltage, so it is discarded and a new
+   conversion is started.
 
-      curVoltageCounts = 0;
-      initialized = false;
+   @return  nothing
+ */
+void FSMSupplySense::update()
+{
+    if (BUSY) {
+        if (ADCSRA & _BV(ADSC)) return;  //still converting
+        BUSY = false;
+        //an analogRead() since the start selects another channel and leaves its own result in ADC
+        bool ownChannel = (ADMUX & 0x1F) == (pin & 0x07) && !(ADCSRB & _BV(MUX5)) == !(pin & 0x08);
+        if (ownChannel) {
+            millivolts = (unsigned int)((ADC * mvPerCountQ16) >> 16);
+            unsigned int mv = (millivolts < FSM_SUPPLY_MIN_MV) ? FSM_SUPPLY_MIN_MV : millivolts;
+            recipQ10 = (unsigned int)((32767UL << 10) / mv);
+            return;
+        }
+        //otherwise the result is discarded and the conversion restarted below
+    } else {
+        unsigned long curTime = millis();
+        if (curTime - lastSample < samplePeriod && recipQ10 != 0) return;
+        lastSample = curTime;
     }
-  }
-}
-
-/*! @brief This function sets the voltage sent to the motor.
-
-  The function accepts values between -255 and 255 counts corresponding with 0-100% duty cycle in the positive and negative directions. Any values lower
-  than -255 counts will be set to -255 counts and values higher than 255 counts will
-  be set to 255 counts. 
-  Positive values will turn the motor in the positive encoder direction, negative 
-  values will turn the motor in the negative encoder direction.
-*/
-FSMMotor2::setVoltage(int voltageCounts) {
-  {
-    if (voltageCounts > 255) voltageCounts = 255;
-    if (voltageCounts < -255) voltageCounts = -255;
-
-    curVoltageCounts = voltageCounts;
-    int pwmVal = 255-abs(voltageCounts);
 
-    if (voltageCounts > 0) {
-      analogWrite(MOTOR2_IN1_PIN, 255);
-      analogWrite(MOTOR2_IN2_PIN, pwmVal);
-    }
-    else {
-      analogWrite(MOTOR2_IN1_PIN, pwmVal);
-      analogWrite(MOTOR2_IN2_PIN, 255);
-    }
-  }
+    //select the channel against AVcc, like analogRead(), and start the conversion
+    ADCSRB = (ADCSRB & ~_BV(MUX5)) | ((pin & 0x08) ? _BV(MUX5) : 0);
+    ADMUX = _BV(REFS0) | (pin & 0x07);
+    ADCSRA |= _BV(ADSC);
+    BUSY = true;
 }
 
-
+#endif //FSM_HAS_TIMER16
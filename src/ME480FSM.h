@@ -28,6 +28,53 @@
 #ifndef ME480FSM_h
 #define ME480FSM_h
 
+#include "Arduino.h"
+#include "FSMTimerRegs.h"
+
+//bits of the packed counter state: the four counter states and the saved inputs
+#define FSM_CNT_WAITING  0x01
+#define FSM_CNT_UP       0x02
+#define FSM_CNT_DOWN     0x04
+#define FSM_CNT_RST      0x08
+#define FSM_CNT_UP_OLD   0x10
+#define FSM_CNT_DOWN_OLD 0x20
+
+//packed state of a waiting counter whose saved inputs equal in_Up and in_Down
+inline uint8_t fsmCounterIdle(bool in_Up, bool in_Down)
+{
+  return FSM_CNT_WAITING | (in_Up ? FSM_CNT_UP_OLD : 0) | (in_Down ? FSM_CNT_DOWN_OLD : 0);
+}
+
+/*!
+   @brief   Runs blocks 1 to 3 of the rising edge counter on a packed state byte
+
+   This is the transition logic of RisingEdgeCounter reduced to a few mask operations. It gives exactly
+   the same next states as evaluating each transition as a separate bool.
+
+   @return  the next state byte, including the new saved inputs
+ */
+inline uint8_t fsmCounterStep(uint8_t state, bool in_Up, bool in_Down, bool RST)
+{
+  //Block 1: unique presses on up and down
+  uint8_t next = (in_Up ? FSM_CNT_UP_OLD : 0) | (in_Down ? FSM_CNT_DOWN_OLD : 0);
+  uint8_t press = next & ~state;
+
+  //Blocks 2 and 3: state transitions
+  if (RST) {
+    if (state & (FSM_CNT_UP | FSM_CNT_DOWN)) next |= FSM_CNT_WAITING;
+    if (state & (FSM_CNT_WAITING | FSM_CNT_UP | FSM_CNT_RST)) next |= FSM_CNT_RST;
+  }
+  else {
+    if (state & (FSM_CNT_UP | FSM_CNT_DOWN | FSM_CNT_RST)) next |= FSM_CNT_WAITING;
+    if (state & FSM_CNT_WAITING) {
+      if (press == FSM_CNT_UP_OLD) next |= FSM_CNT_UP;
+      else if (press == FSM_CNT_DOWN_OLD) next |= FSM_CNT_DOWN;
+      else next |= FSM_CNT_WAITING;  //no press, or both at once
+    }
+  }
+  return next;
+}
+
  /*!
   @brief  This class impliments rising edge up-down counters
 
@@ -53,19 +100,427 @@ class RisingEdgeCounter
         bool CNT;     ///<Status bit of counter; true if the number of counts is greater than, or equal to, the preset value
 
 
-    //private variables are ones that can't be accessed by main program
+    //protected variables can't be accessed by main program, only by counters built on this one
         //note that these variables only exists in the RisingEdgeCounter class so
         //duplicate names in other classes do not create a conflict
-    private:
-        //no real need for the states to be known by main program
-        bool state_Waiting; 
-        bool state_Up;
-        bool state_Down;
-        bool state_RST;
-        bool in_Up_Old;
-        bool in_Down_Old;
+    protected:
+        //no real need for the states to be known by main program.
+        //the states and the old inputs are packed in one byte (FSM_CNT_ bits)
+        uint8_t state;
+};
+
+/*!
+ @brief  This class impliments a rising edge counter with many setpoints, like a cam switch
+
+ The CamCounter class is a RisingEdgeCounter with a list of up to 32 thresholds, sorted from lowest to
+ highest. Bit i of crossed is true while the count is greater than, or equal to, thresholds[i], and
+ numCrossed tells how many thresholds that is. Because the list is sorted, a change in the count only
+ needs to be compared with the next threshold above and the next one below, however many thresholds
+ there are. The preset (and therefore CNT) is set to the last threshold.
+ The threshold array is not copied, so it must stay in memory (a global const array) while the counter is used.
+*/
+class CamCounter : public RisingEdgeCounter
+{   //public functions and variables that can be accessed by user
+public:
+  CamCounter(const long *_thresholds, uint8_t _numThresholds);
+
+  //function that runs the state machine
+  void update(bool in_Up, bool in_Down, bool RST);//function that runs the state machine.
+
+  //variables that can be queried by main program:
+  unsigned long crossed;  ///<Bit i is true if count is greater than, or equal to, thresholds[i]
+  uint8_t numCrossed;     ///<Number of thresholds that count has reached
+
+private:
+  void track();
+  const long *thresholds;
+  uint8_t numThresholds;
+};
+
+//measurement modes for RateCounter
+#define FSM_RATE_GATED      0   ///<Rate from the number of counts in each window
+#define FSM_RATE_RECIPROCAL 1   ///<Rate from the time between consecutive counts
+#define FSM_RATE_ONE        256 ///<Value of RateCounter::rate for one count per second
+
+/*!
+ @brief  This class impliments a rising edge counter that also measures the count rate
+
+ The RateCounter class is a RisingEdgeCounter that reports how many up counts happen per second, in
+ 24.8 fixed point (divide rate by FSM_RATE_ONE, or 256.0, to get counts per second). There are two modes:
+ - FSM_RATE_GATED counts the up counts over each window of milliseconds and works best at high rates<br>
+ - FSM_RATE_RECIPROCAL times the interval between consecutive up counts in microseconds, giving a new,
+   fine-grained value at every count. It works best at low rates. The rate drops to 0 when no count
+   arrives within one window
+ .
+ A single clock read per update replaces the extra FSMTimer and counter that a sketch would otherwise need.
+*/
+class RateCounter : public RisingEdgeCounter
+{   //public functions and variables that can be accessed by user
+public:
+  RateCounter(long _preset, unsigned long _window, uint8_t _mode = FSM_RATE_GATED);
+
+  //function that runs the state machine
+  void update(bool in_Up, bool in_Down, bool RST);//function that runs the state machine.
+
+  //variables that can be queried by main program:
+  unsigned long window;  ///<Gate time in milliseconds (gated), or time without counts before the rate reads 0 (reciprocal)
+  unsigned long rate;    ///<Up counts per second in 24.8 fixed point
+
+private:
+  uint8_t mode;
+  unsigned long lastTime;   //start of the window in ms (gated) or time of the last count in us (reciprocal)
+  unsigned long edges;      //up counts in the current window (gated)
+  bool haveEdge;            //a count has been timed (reciprocal)
+};
+
+#define FSM_PERSIST_RECORD 6  ///<EEPROM bytes used by each slot of an FSMPersistentValue
+
+/*!
+ @brief  This class keeps a value in EEPROM across power cycles
+
+ The FSMPersistentValue class stores a long in a ring of slots in EEPROM, starting at baseAddress and using
+ FSM_PERSIST_RECORD bytes per slot. Each save goes to the next slot, so the wear is spread over all of them.
+ A slot holds the value, a check byte and a sequence number that is written last. The newest slot is the one
+ whose sequence number is not followed by the next number, and a slot whose check byte does not match (a write
+ cut off by a power loss) is skipped, so the last complete save is restored by the constructor.
+
+ update() is called every scan with the current value. A save is only started when the value differs from the
+ saved one and at least minInterval milliseconds have passed since the last save, so a value that changes
+ quickly is coalesced into one write. A save never waits for the EEPROM: each update writes at most one byte,
+ and only when the EEPROM has finished the previous one (about 3.3ms per byte), so it costs a few
+ microseconds per scan. BUSY is true while a save is in progress.
+ It can hold any long, for example a counter's count or a run time accumulated from FSMTimer::elapsed.
+*/
+class FSMPersistentValue
+{   //public functions and variables that can be accessed by user
+public:
+  FSMPersistentValue(unsigned int _baseAddress, uint8_t _slots, unsigned long _minInterval);
+
+  //function that runs the state machine; saves _value in the background when it has changed
+  void update(long _value);
+
+  //variables that can be queried by main program:
+  long value;             ///<Value restored at construction, then the last value that was saved
+  unsigned long minInterval;  ///<Least time in milliseconds between the start of two saves
+  bool BUSY;              ///<Status bit; true while a save is being written
+
+private:
+  unsigned int slotAddress(uint8_t slot) { return baseAddress + (unsigned int)slot * FSM_PERSIST_RECORD; }
+  static uint8_t check(const uint8_t *record);
+  unsigned int baseAddress;
+  uint8_t slots;
+  uint8_t slot;            //newest complete slot, or the slot being written while BUSY
+  uint8_t seq;             //sequence number of slot
+  uint8_t written;         //bytes of record written so far
+  uint8_t record[FSM_PERSIST_RECORD];  //value, check byte and sequence number being written
+  unsigned long lastSave;
+};
+
+/*!
+ @brief  This class impliments a rising edge counter whose count survives a power cycle
+
+ The PersistentCounter class is a RisingEdgeCounter whose count is restored from EEPROM when it is constructed
+ and saved by an FSMPersistentValue; see FSMPersistentValue for the EEPROM layout and write timing.
+ Counts that happen between two saves, or within minInterval of a power loss, are not saved.
+*/
+class PersistentCounter : public RisingEdgeCounter
+{   //public functions and variables that can be accessed by user
+public:
+  PersistentCounter(long _preset, unsigned int _baseAddress, uint8_t _slots = 8, unsigned long _minInterval = 1000);
+
+  //function that runs the state machine
+  void update(bool in_Up, bool in_Down, bool RST);//function that runs the state machine.
+
+  FSMPersistentValue store;  ///<EEPROM storage of the count
+};
+
+/*!
+ @brief  This class impliments rising edge up-down counters with a chosen count width
+
+ RisingEdgeCounterT works exactly like RisingEdgeCounter, but count and preset are both of the unsigned
+ type T, so CNT is computed at the width of the counter instead of promoting to 32 bits. The count
+ saturates: it stops at the largest value of T when counting up and at 0 when counting down, instead of
+ overflowing. Use it through RisingEdgeCounter8, RisingEdgeCounter16, RisingEdgeCounter32 or
+ RisingEdgeCounter64, for example RisingEdgeCounter8 laps(10);
+*/
+template<typename T>
+class RisingEdgeCounterT
+{   //public functions and variables that can be accessed by user
+public:
+  static_assert((T)-1 > 0, "RisingEdgeCounterT needs an unsigned count type");
+
+  RisingEdgeCounterT(T _preset); //add leading underscore to avoid confusing this for the class's "stored" preset
+
+  //function that runs the state machine
+  void update(bool in_Up, bool in_Down, bool RST);//function that runs the state machine.
+
+  //variables that can be queried by main program:
+  T preset;     ///<Sets/returns the number of counts that will trip the state of counting variable
+  T count;      ///<Returns the current number of counts
+  bool CNT;     ///<Status bit of counter; true if the number of counts is greater than, or equal to, the preset value
+
+private:
+  //the states and the old inputs are packed in one byte (FSM_CNT_ bits)
+  uint8_t state;
+};
+
+typedef RisingEdgeCounterT<uint8_t> RisingEdgeCounter8;    ///<Counter saturating at 255
+typedef RisingEdgeCounterT<uint16_t> RisingEdgeCounter16;  ///<Counter saturating at 65535
+typedef RisingEdgeCounterT<uint32_t> RisingEdgeCounter32;  ///<Counter saturating at 4294967295
+typedef RisingEdgeCounterT<uint64_t> RisingEdgeCounter64;  ///<Counter that will not saturate in practice
+
+/*!
+   @brief   This function runs when you "construct" a rising edge counter
+
+   @param   _preset (T) Sets the preset count when the state of the counter changes
+ */
+template<typename T>
+RisingEdgeCounterT<T>::RisingEdgeCounterT(T _preset)
+{
+  preset = _preset;
+  state = FSM_CNT_WAITING;
+  count = 0;
+  CNT = (count >= preset);
+}
+
+/*!
+   @brief   This function updates the counter based on a change in the rising edge of the input variables or the value of the RST variable.
+
+   See RisingEdgeCounter::update. The count does not go above the largest value of T.
+
+   @return  nothing
+
+   @param   in_Up (bool) a false to true transition in this variable will increment the counter
+   @param   in_Down (bool) a false to true transition in this variable will decrement the counter
+   @param   RST (bool) true will reset the counter to 0, does not need a false to true transition
+ */
+template<typename T>
+void RisingEdgeCounterT<T>::update(bool in_Up, bool in_Down, bool RST)
+{
+  //fast path: waiting with unchanged inputs and no reset, so the state and count stay the same
+  if (!RST && state == fsmCounterIdle(in_Up, in_Down)) {
+    CNT = (count >= preset);
+    return;
+  }
+
+  //Blocks 1-3: unique presses and state transitions on the packed state
+  state = fsmCounterStep(state, in_Up, in_Down, RST);
+
+  //Block 4: outputs
+  if ((state & FSM_CNT_UP) && count != (T)~(T)0) count++;
+  if ((state & FSM_CNT_DOWN) && count > 0) count--;
+  if (state & FSM_CNT_RST) count = 0;
+  CNT = (count >= preset);
+}
+
+//index of the lowest set bit of a non-zero word
+inline uint8_t fsmLowestBit(uint8_t w) { return __builtin_ctz(w); }
+inline uint8_t fsmLowestBit(uint16_t w) { return __builtin_ctz(w); }
+inline uint8_t fsmLowestBit(uint32_t w) { return __builtin_ctzl(w); }
+inline uint8_t fsmLowestBit(uint64_t w) { return __builtin_ctzll(w); }
+
+/*!
+ @brief  This class impliments a bank of 8, 16, 32 or 64 rising edge up-down counters
+
+ The CounterBank class runs as many RisingEdgeCounters as there are bits in W (uint8_t, uint16_t,
+ uint32_t or uint64_t). Bit i of each input word is an input of counter i, and the states and old inputs
+ of all counters are stored one bit per counter in a word each. Edge detection and the state transitions
+ therefore run for every counter at once with a handful of bitwise operations, and only the counters
+ whose up, down or reset state is active get their count changed. Each counter behaves exactly like a
+ RisingEdgeCounter.
+
+ The counts are read from count[i] and the status bits from the CNT word. Presets are changed with
+ setPreset() so the CNT bit is refreshed.
+*/
+template<typename W>
+class CounterBank
+{   //public functions and variables that can be accessed by user
+public:
+  static const uint8_t SIZE = sizeof(W) * 8;  ///<Number of counters in the bank
+
+  CounterBank(long _preset); //every counter starts with this preset
+
+  //function that runs the state machines; bit i of each word is an input of counter i
+  void update(W in_Up, W in_Down, W RST);
+
+  //sets the preset of counter i
+  void setPreset(uint8_t i, long _preset);
+  long getPreset(uint8_t i) { return preset[i]; }
+
+  //variables that can be queried by main program:
+  int count[SIZE];  ///<Current number of counts of each counter
+  W CNT;            ///<Status bits; bit i is true if count[i] is greater than, or equal to, its preset
+
+private:
+  long preset[SIZE];
+  //one bit per counter for each state and old input
+  W state_Waiting;
+  W state_Up;
+  W state_Down;
+  W state_RST;
+  W in_Up_Old;
+  W in_Down_Old;
+};
+
+/*!
+   @brief   This function runs when you "construct" a counter bank
+
+   All counters start waiting with a count of 0 and the given preset.
+
+   @param   _preset (long) preset count of every counter
+ */
+template<typename W>
+CounterBank<W>::CounterBank(long _preset)
+{
+  state_Waiting = (W)~(W)0;
+  state_Up = 0;
+  state_Down = 0;
+  state_RST = 0;
+  in_Up_Old = 0;
+  in_Down_Old = 0;
+  CNT = 0;
+  for (uint8_t i = 0; i < SIZE; i++) {
+    count[i] = 0;
+    setPreset(i, _preset);
+  }
+}
+
+/*!
+   @brief   Sets the preset of one counter and refreshes its CNT bit
+
+   @param   i (uint8_t) counter number
+   @param   _preset (long) preset count
+ */
+template<typename W>
+void CounterBank<W>::setPreset(uint8_t i, long _preset)
+{
+  preset[i] = _preset;
+  if (count[i] >= _preset) CNT |= (W)((W)1 << i);
+  else CNT &= (W)~((W)1 << i);
+}
+
+/*!
+   @brief   This function updates every counter in the bank
+
+   Bit i of each argument is the in_Up, in_Down or RST input of counter i; see RisingEdgeCounter::update.
+
+   @return  nothing
+ */
+template<typename W>
+void CounterBank<W>::update(W in_Up, W in_Down, W RST)
+{
+  //Block 1: unique presses on up and down, for every counter at once
+  W upp = in_Up & ~in_Up_Old;
+  W dnp = in_Down & ~in_Down_Old;
+
+  //Block 2: State Transition Logic.
+  W waitNoRST = state_Waiting & ~RST;
+  W waitToUp = waitNoRST & upp & ~dnp;
+  W waitToDown = waitNoRST & dnp & ~upp;
+  W waitToWait = waitNoRST & ~(upp ^ dnp);
+  W RSTToWait = state_RST & ~RST;
+  W toRST = RST & (state_Waiting | state_Up | state_RST);
+
+  //Block 3: Update States
+  state_Waiting = state_Up | state_Down | RSTToWait | waitToWait;
+  state_Up = waitToUp;
+  state_Down = waitToDown;
+  state_RST = toRST;
+
+  //Block 4: outputs for the counters that moved, and old variables
+  W fired = state_Up | state_Down | state_RST;
+  while (fired) {
+    uint8_t i = fsmLowestBit(fired);
+    W bit = (W)((W)1 << i);
+    if (state_Up & bit) count[i]++;
+    if ((state_Down & bit) && count[i] > 0) count[i]--;
+    if (state_RST & bit) count[i] = 0;
+    if (count[i] >= preset[i]) CNT |= bit;
+    else CNT &= (W)~bit;
+    fired &= (W)(fired - 1);
+  }
+
+  in_Up_Old = in_Up;
+  in_Down_Old = in_Down;
+}
+
+/*!
+ @brief  This class impliments a bank of 8 or 16 switch debouncers
+
+ The Debouncer class debounces as many inputs as there are bits in W (uint8_t or uint16_t) with a
+ vertical counter: each input has a 2-bit counter, stored one bit per input in the words cnt0 and cnt1,
+ that counts the samples in a row which differ from the debounced state. The debounced state of an input
+ only changes after 4 such samples in a row, and the counter starts over whenever the sample agrees with
+ the state again. All inputs are handled at once with a handful of bitwise operations, so a whole port
+ costs about as much as one input.
+
+ update() should be called at a fixed rate with one read of the port, for example
+ `if (sampleTimer.TMR) buttons.update(PINA);` with a 5ms FSMTimer run by updatePeriodic(), which
+ accepts a switch after it has been stable for 20ms. The state word can be passed straight to
+ CounterBank::update, and bits of it to RisingEdgeCounter::update or an FSM.
+*/
+template<typename W>
+class Debouncer
+{   //public functions and variables that can be accessed by user
+public:
+  Debouncer(W initial = 0); //debounced state before the first sample
+
+  //function that runs the debouncers; bit i of sample is the raw value of input i
+  void update(W sample);
+
+  bool read(uint8_t i) { return (state >> i) & 1; }
+
+  //variables that can be queried by main program:
+  W state;  ///<Debounced value of each input
+  W rose;   ///<Bits whose debounced value became true during the last update
+  W fell;   ///<Bits whose debounced value became false during the last update
+
+private:
+  //2-bit vertical counter, one bit per input in each word
+  W cnt0;
+  W cnt1;
 };
 
+/*!
+   @brief   This function runs when you "construct" a debouncer bank
+
+   @param   initial (W) debounced value of the inputs until they have been sampled
+ */
+template<typename W>
+Debouncer<W>::Debouncer(W initial)
+{
+  state = initial;
+  rose = 0;
+  fell = 0;
+  cnt0 = 0;
+  cnt1 = 0;
+}
+
+/*!
+   @brief   This function takes one sample of every input and updates the debounced state
+
+   @return  nothing
+
+   @param   sample (W) raw inputs, usually one PINx read
+ */
+template<typename W>
+void Debouncer<W>::update(W sample)
+{
+  //inputs that disagree with the debounced state
+  W delta = sample ^ state;
+
+  //inputs that disagreed on the last 3 samples and still do are accepted
+  W toggle = delta & cnt0 & cnt1;
+
+  //count the samples in a row that disagree, and clear the count of the inputs that agree
+  cnt1 = (cnt1 ^ cnt0) & delta;
+  cnt0 = ~cnt0 & delta;
+
+  state ^= toggle;
+  rose = toggle & state;
+  fell = toggle & ~state;
+}
+
 /*!
  @brief  This class impliments a millisecond timer
 
@@ -86,6 +541,8 @@ class FSMTimer
 
         //function that runs the state machine
         void update(bool enable);//function that runs the state machine.
+        //runs the timer as a fixed-rate periodic timer, returns the number of missed periods
+        unsigned long updatePeriodic(bool enable);
 
         //variables that can be queried by main program:
         unsigned long duration; ///<Duration value of the timer in milliseconds
@@ -124,6 +581,8 @@ public:
 
   //function that runs the state machine
   void update(bool enable);//function that runs the state machine.
+  //runs the timer as a fixed-rate periodic timer, returns the number of missed periods
+  unsigned long updatePeriodic(bool enable);
 
   //variables that can be queried by main program:
   unsigned long duration; ///<Duration value of the timer in milliseconds
@@ -141,105 +600,1609 @@ private:
   bool state_Timing;
 };
 
+//picks type A when the condition is true and type B otherwise (std::conditional is not available on AVR)
+template<bool Cond, typename A, typename B> struct FSMSelectType { typedef A type; };
+template<typename A, typename B> struct FSMSelectType<false, A, B> { typedef B type; };
+
+//true for the millis() clock, whose 16-bit range leaves room for slow scans
+template<unsigned long (*Clock)()> struct FSMClockIsMillis { static const bool value = false; };
+template<> struct FSMClockIsMillis<millis> { static const bool value = true; };
+
 /*!
- @brief  This class impliments a quadrature based encoder attached to the Motor1 connector
+ @brief  This class impliments a timer whose duration is fixed at compile time
 
-The FSMEncoder1 class supports a quadrature based encoder attached to the Motor1 connector.
-The number of counts can be accessed through the getCounts and getCountsAndReset functions.
+ FSMConstDurationTimer works like FSMTimer, but the duration is a template argument so it is
+ stored in flash as part of the comparison instead of in SRAM. For the millis() clock
+ (FSMConstTimer) with a duration below 32768, the start and elapsed times are kept in 16 bits,
+ which halves their storage and the cost of the subtraction and comparison on AVR. Use it through
+ the FSMConstTimer (milliseconds) and FSMConstFastTimer (microseconds) names, for example
+ FSMConstTimer<500> blink;
+
+ Once TMR is true the timer stops reading the clock and elapsed holds the value it had when the
+ timer expired. A 16-bit timer must be updated at least once every 65536 - Duration milliseconds
+ while it is timing (more than 32 seconds), or it misses its deadline. FSMConstFastTimer always
+ uses 32 bits, since 16 bits of microseconds would wrap every 65.5ms.
 */
-class FSMEncoder1
-{//public functions and variables that can be accessed by user
+template<unsigned long Duration, unsigned long (*Clock)()>
+class FSMConstDurationTimer
+{   //public functions and variables that can be accessed by user
 public:
-  // Constructor/destructor:
-  //must declare the class itself as public
-  FSMEncoder1(); //which motor control socket is being used
-  ~FSMEncoder1(void);
-
-  //Returns the current number of encoder counts
-  long getCounts();
+  //16 bits are enough for millis() when the duration leaves half the range as margin between updates
+  typedef typename FSMSelectType<(FSMClockIsMillis<Clock>::value && Duration < 0x8000UL),
+                                 uint16_t, unsigned long>::type Time;
 
-  //Returns the current number of encoder counts and resets the counts to 0
-  long getCountsAndReset();
+  FSMConstDurationTimer();
 
-//private variables are ones that can't be accessed by main program
-    //note that these variables only exists in the FSMFastTimer class so
-    //duplicate names in other classes do not create a conflict
-private: 
-  bool initialized = false;       //has the system been initialized?
+  //function that runs the state machine
+  void update(bool enable);//function that runs the state machine.
 
-  static void Encoder1AISR();
-  static void Encoder1BISR();
+  //variables that can be queried by main program:
+  static const unsigned long duration = Duration; ///<Duration value of the timer, stored in flash
+  Time elapsed;           ///<Elapsed time that the timer has been counting
+  bool TMR;               ///<Status bit of timer; true if elapsed time is greater than, or equal to, the duration value
 
+private:
+  //starttime not needed by main program
+  Time startTime;
+  //the waiting state is !state_Timing
+  bool state_Timing;
 };
 
+template<unsigned long Duration>
+using FSMConstTimer = FSMConstDurationTimer<Duration, millis>;     ///<Compile-time duration timer in milliseconds
+template<unsigned long Duration>
+using FSMConstFastTimer = FSMConstDurationTimer<Duration, micros>; ///<Compile-time duration timer in microseconds
+
 /*!
- @brief  This class impliments a quadrature based encoder attached to the Motor2 connector
+   @brief   This function runs when you "construct" a compile-time duration timer
 
-The FSMEncoder2 class supports a quadrature based encoder attached to the Motor1 connector.
-The number of counts can be accessed through the getCounts and getCountsAndReset functions.
-The velocity can be calculated using the get2CountDeltaT function that returns the amount of
-time, in microseconds, while the sensor moved two counts.
-*/
-class FSMEncoder2
-{//public functions and variables that can be accessed by user
-public:
-  // Constructor/destructor:
-  //must declare the class itself as public
-  FSMEncoder2(); //which motor control socket is being used
-  ~FSMEncoder2(void);
+   The timer starts in the waiting (non-timing) state.
+ */
+template<unsigned long Duration, unsigned long (*Clock)()>
+FSMConstDurationTimer<Duration, Clock>::FSMConstDurationTimer()
+{
+  state_Timing = false;
+  startTime = 0;
+  elapsed = 0;
+  TMR = (Duration == 0);
+}
 
+/*!
+   @brief   This function updates the timer based on the enable input.
 
-  //Returns the current number of encoder counts
-  long getCounts();
+   If enable is true the timer checks to see if the elapsed time is greater than the duration and sets the
+   TMR value<br>
+   If enable is false the timer resets
 
-  //Returns the current number of encoder counts and resets the counts to 0
-  long getCountsAndReset();
+   @return  nothing
 
-  //private variables are ones that can't be accessed by main program
-      //note that these variables only exists in the FSMFastTimer class so
-      //duplicate names in other classes do not create a conflict
-private:
-  bool initialized = false;       //has the system been initialized?
+   @param   enable (bool) a turns the timer on or off
+ */
+template<unsigned long Duration, unsigned long (*Clock)()>
+void FSMConstDurationTimer<Duration, Clock>::update(bool enable)
+{
+  //fast path: a disabled timer that is already waiting, or an expired timer that is still
+  //enabled, does not change, so the clock is not read
+  if (!state_Timing && !enable) {
+    elapsed = 0;
+    TMR = (duration == 0);
+    return;
+  }
+  if (state_Timing && enable && TMR) return;
 
-  static void Encoder2AISR();
-  static void Encoder2BISR();
+  //Block 2: State Transition Logic.
+  bool waitToTime = !state_Timing && enable;
+  bool timeToTime = state_Timing && enable;
+
+  //Block 3: Update States
+  state_Timing = waitToTime || timeToTime;
+
+  //Block 4: outputs and old variables
+  Time curTime = (Time)Clock();
+  if (!timeToTime) {
+    startTime = curTime;  //timing starts on the scan the timer is enabled
+  }
+  elapsed = curTime - startTime;
+  TMR = (elapsed >= (Time)Duration);
+}
 
+/*!
+ @brief  Tick counter shared by all compact timers with the same clock and tick unit
+
+ Converts millis() or micros() into a count of Unit-sized ticks. The conversion is cached, so the
+ division only runs when several ticks have passed between calls; otherwise a tick is added by a
+ single comparison. With Unit equal to 1 the clock is returned directly.
+*/
+template<unsigned long (*Clock)(), unsigned int Unit>
+struct FSMTickClock
+{
+  static unsigned long now();
 
+  static unsigned long lastTime;  ///<Clock time of the most recent whole tick
+  static unsigned long count;     ///<Number of whole ticks
 };
 
+template<unsigned long (*Clock)(), unsigned int Unit> unsigned long FSMTickClock<Clock, Unit>::lastTime = 0;
+template<unsigned long (*Clock)(), unsigned int Unit> unsigned long FSMTickClock<Clock, Unit>::count = 0;
 
+template<unsigned long (*Clock)(), unsigned int Unit>
+unsigned long FSMTickClock<Clock, Unit>::now()
+{
+  if (Unit == 1) return Clock();
+  unsigned long delta = Clock() - lastTime;
+  if (delta >= Unit) {
+    if (delta < 2 * Unit) {
+      count++;
+      lastTime += Unit;
+    }
+    else {
+      unsigned long n = delta / Unit;
+      count += n;
+      lastTime += n * Unit;
+    }
+  }
+  return count;
+}
 
 /*!
- @brief  This class impliments the motor when it is connected to motor connector 2. 
+ @brief  This class impliments a timer with 8 or 16 bit storage
 
-The FSMMotor2 class supports running the motor when it is connected to the motor 2 connector and 
-run with the DRV8837 motor driver. This class uses the a pin configuration that minimizes non-linearities 
-in the driver.
-The voltage of the motor can be set between -255 and 255 counts, corresponding with duty cycles between 0 and 100% in each direction. Positive voltages turn the motor
-in the same direction as positive encoder counts.
-The current motor voltage can be accessed through the curVoltage variable.
+ FSMCompactTimerBase works like FSMTimer but keeps duration, elapsed and the start time in the
+ type T (uint8_t or uint16_t), counted in ticks of Unit milliseconds (or microseconds for the fast
+ versions). The state and TMR share a single byte. A 16-bit timer with a 10ms tick reaches 655s in
+ 7 bytes of SRAM instead of 15, and every subtraction and comparison is 8 or 16 bits wide on AVR.
+ Use it through FSMCompactTimer16, FSMCompactTimer8, FSMCompactFastTimer16 or FSMCompactFastTimer8,
+ for example FSMCompactTimer16<10> debounce(5); //50 to 60ms
 
-This class does not control the relay on the MicroRig board.
+ The clock is read in whole ticks, so the timer has a resolution of one tick. The scan that enables it
+ can fall anywhere inside a tick, so with Unit above 1 TMR goes true only once elapsed is greater than
+ the duration: the timer never fires early, and fires up to one tick late.
+ Once TMR is true the timer stops reading the clock and elapsed holds the value it had when the timer
+ expired. While timing, update() must be called at least once every (range of T - duration - 1) ticks.
 */
-class FSMMotor2
-{//public functions and variables that can be accessed by user
+template<typename T, unsigned int Unit, unsigned long (*Clock)()>
+class FSMCompactTimerBase
+{   //public functions and variables that can be accessed by user
 public:
-  // Constructor/destructor:
-  //must declare the class itself as public
-  FSMMotor2(); //used for motor socket #2
-  ~FSMMotor2(void);
+  FSMCompactTimerBase(T _duration); //add leading underscore to avoid confusing this for the class's "stored" duration
 
-  //set the voltage of the motor 
-  setVoltage(int voltageCounts);
+  //function that runs the state machine
+  void update(bool enable);//function that runs the state machine.
 
   //variables that can be queried by main program:
-  int curVoltageCounts; ///<current voltage set for the motor
+  T duration;             ///<Duration value of the timer in ticks
+  T elapsed;              ///<Elapsed time, in ticks, that the timer has been counting
+  bool TMR : 1;           ///<Status bit of timer; true once the full duration has passed (elapsed greater than duration when Unit is above 1)
 
-  //private variables are ones that can't be accessed by main program
-      //note that these variables only exists in the FSMFastTimer class so
-      //duplicate names in other classes do not create a conflict
 private:
-  bool initialized = false;       //has the system been initialized?
-
+  //shares a byte with TMR; the waiting state is !state_Timing
+  bool state_Timing : 1;
+  //starttime not needed by main program
+  T startTime;
 };
-#endif
\ No newline at end of file
+
+template<unsigned int UnitMs = 1>
+using FSMCompactTimer16 = FSMCompactTimerBase<uint16_t, UnitMs, millis>;     ///<16-bit timer in ticks of UnitMs milliseconds
+template<unsigned int UnitMs = 1>
+using FSMCompactTimer8 = FSMCompactTimerBase<uint8_t, UnitMs, millis>;       ///<8-bit timer in ticks of UnitMs milliseconds
+template<unsigned int UnitUs = 1>
+using FSMCompactFastTimer16 = FSMCompactTimerBase<uint16_t, UnitUs, micros>; ///<16-bit timer in ticks of UnitUs microseconds
+template<unsigned int UnitUs = 1>
+using FSMCompactFastTimer8 = FSMCompactTimerBase<uint8_t, UnitUs, micros>;   ///<8-bit timer in ticks of UnitUs microseconds
+
+/*!
+   @brief   This function runs when you "construct" a compact timer
+
+   @param   _duration (T) sets the duration of the timer in ticks
+ */
+template<typename T, unsigned int Unit, unsigned long (*Clock)()>
+FSMCompactTimerBase<T, Unit, Clock>::FSMCompactTimerBase(T _duration)
+{
+  duration = _duration;
+  state_Timing = false;
+  TMR = false;
+  startTime = 0;
+  elapsed = 0;
+}
+
+/*!
+   @brief   This function updates the timer based on the enable input.
+
+   If enable is true the timer checks to see if the elapsed time is greater than the preset duration and sets the
+   TMR value<br>
+   If enable is false the timer resets
+
+   @return  nothing
+
+   @param   enable (bool) a turns the timer on or off
+ */
+template<typename T, unsigned int Unit, unsigned long (*Clock)()>
+void FSMCompactTimerBase<T, Unit, Clock>::update(bool enable)
+{
+  //fast path: a disabled timer that is already waiting, or an expired timer that is still
+  //enabled, does not change, so the clock is not read
+  if (!state_Timing && !enable) {
+    elapsed = 0;
+    TMR = (duration == 0);
+    return;
+  }
+  if (state_Timing && enable && TMR) return;
+
+  //Block 2: State Transition Logic.
+  bool waitToTime = !state_Timing && enable;
+  bool timeToTime = state_Timing && enable;
+
+  //Block 3: Update States
+  state_Timing = waitToTime || timeToTime;
+
+  //Block 4: outputs and old variables
+  T curTime = (T)FSMTickClock<Clock, Unit>::now();
+  if (!timeToTime) {
+    startTime = curTime;  //timing starts on the scan the timer is enabled
+  }
+  elapsed = curTime - startTime;
+  //with ticks longer than 1 the first tick may be partly over, so one more is needed to not fire early
+  TMR = (Unit > 1 && duration != 0) ? (elapsed > duration) : (elapsed >= duration);
+}
+
+#ifdef FSM_HAS_TIMER16
+
+//clock select values for FSMHardwareClock::begin
+#define FSM_HWCLOCK_DIV1 1   ///<Hardware clock counts every CPU cycle (62.5ns at 16MHz)
+#define FSM_HWCLOCK_DIV8 2   ///<Hardware clock counts every 8 CPU cycles (0.5us at 16MHz)
+#define FSM_HWCLOCK_EXT_FALLING 6 ///<Hardware clock counts falling edges on the timer's Tn pin
+#define FSM_HWCLOCK_EXT_RISING  7 ///<Hardware clock counts rising edges on the timer's Tn pin
+
+/*!
+ @brief  This class impliments a 32 bit time base on one of the 16-bit hardware timers
+
+ The FSMHardwareClock class takes over Timer1, 3, 4 or 5 (chosen by the template argument) and runs it
+ freely at the full or divided-by-8 CPU clock. The 16-bit count is extended to 32 bits by the timer's
+ overflow interrupt, so ticks() gives exact, sub-microsecond time stamps without calling micros().
+ At 16MHz one tick is 62.5ns (FSM_HWCLOCK_DIV1, wraps after 268s) or 0.5us (FSM_HWCLOCK_DIV8, wraps after 35min).
+
+ begin() must be called from setup(), since the Arduino core configures the timers for analogWrite
+ after global objects have been constructed. The timer can no longer be used for PWM on its pins, and its
+ compare A interrupt is reserved for FSMCallbackTimer.
+ Timer4 drives the FSMMotor2 outputs (pins 6 and 8) and Timer1 the FSMMotor1 outputs (pins 11 and 12),
+ so they should not be used while that motor is attached.
+*/
+template<uint8_t TimerNum>
+class FSMHardwareClock
+{
+public:
+  //starts the timer running from the given clock select (FSM_HWCLOCK_DIV1, FSM_HWCLOCK_DIV8 or an external edge)
+  static void begin(uint8_t clockSelect = FSM_HWCLOCK_DIV8);
+
+  //returns the current time in timer ticks
+  static unsigned long ticks();
+
+  //converts between microseconds and timer ticks
+  static unsigned long microsToTicks(unsigned long us) { return us * ticksPerMicro; }
+  static unsigned long ticksToMicros(unsigned long t) { return t / ticksPerMicro; }
+
+  static volatile uint16_t overflows; ///<Upper 16 bits of the tick count, incremented by the overflow interrupt
+  static uint8_t ticksPerMicro;       ///<Number of timer ticks per microsecond for the selected clock
+};
+
+//the overflow counters are defined next to their interrupt handlers (FSMHardwareClockN.cpp)
+//so that a timer's overflow vector is only claimed by sketches that use that timer
+template<> volatile uint16_t FSMHardwareClock<1>::overflows;
+template<> volatile uint16_t FSMHardwareClock<3>::overflows;
+template<> volatile uint16_t FSMHardwareClock<4>::overflows;
+template<> volatile uint16_t FSMHardwareClock<5>::overflows;
+
+template<uint8_t TimerNum> uint8_t FSMHardwareClock<TimerNum>::ticksPerMicro = 0;
+
+/*!
+   @brief   Configures the timer as a free running 32 bit clock
+
+   The timer is put in normal mode with the output compare pins disconnected, its count is
+   cleared and the overflow interrupt is enabled.
+
+   @return  nothing
+
+   @param   clockSelect (uint8_t) FSM_HWCLOCK_DIV1, FSM_HWCLOCK_DIV8, FSM_HWCLOCK_EXT_RISING or FSM_HWCLOCK_EXT_FALLING
+ */
+template<uint8_t TimerNum>
+void FSMHardwareClock<TimerNum>::begin(uint8_t clockSelect)
+{
+  typedef FSMTimerRegs<TimerNum> R;
+  uint8_t oldSREG = SREG;
+  cli();
+  R::tccrb() = 0;               //stop the timer while it is reconfigured
+  R::tccra() = 0;               //normal mode, compare outputs disconnected
+  R::tcnt() = 0;
+  overflows = 0;
+  R::tifr() = _BV(R::TOV);      //discard any overflow left over from PWM operation
+  R::timsk() = _BV(R::TOIE);
+  if (clockSelect == FSM_HWCLOCK_DIV1) ticksPerMicro = F_CPU / 1000000UL;
+  else if (clockSelect == FSM_HWCLOCK_DIV8) ticksPerMicro = F_CPU / 8000000UL;
+  else ticksPerMicro = 0;  //counting external edges, not time
+  R::tccrb() = clockSelect;
+  SREG = oldSREG;
+}
+
+/*!
+   @brief   Returns the current 32 bit tick count
+
+   Safe to call from interrupts. An overflow that occurred after interrupts were disabled, but has not
+   yet been counted by the interrupt, is detected from the overflow flag and added here.
+
+   @return  timer ticks since begin() was called
+ */
+template<uint8_t TimerNum>
+unsigned long FSMHardwareClock<TimerNum>::ticks()
+{
+  typedef FSMTimerRegs<TimerNum> R;
+  uint8_t oldSREG = SREG;
+  cli();
+  uint16_t low = R::tcnt();
+  uint16_t high = overflows;
+  if ((R::tifr() & _BV(R::TOV)) && low < 0x8000) high++;
+  SREG = oldSREG;
+  return ((unsigned long)high << 16) | low;
+}
+
+/*!
+ @brief  This class impliments a timer with sub-microsecond resolution on a hardware clock
+
+ The FSMHardwareTimer class works like FSMFastTimer but takes its time from FSMHardwareClock<TimerNum>
+ instead of micros(), so durations of a few microseconds are timed exactly. The duration and elapsed
+ time are in clock ticks; use FSMHardwareClock<TimerNum>::microsToTicks() to convert from microseconds.
+ FSMHardwareClock<TimerNum>::begin() must be called in setup() before the timer is updated.
+*/
+template<uint8_t TimerNum>
+class FSMHardwareTimer
+{   //public functions and variables that can be accessed by user
+public:
+  // Constructor/destructor:
+  //must declare the class itself as public
+  FSMHardwareTimer(unsigned long _duration); //add leading underscore to avoid confusing this for the class's "stored" duration
+  ~FSMHardwareTimer(void) {}
+
+  //function that runs the state machine
+  void update(bool enable);//function that runs the state machine.
+
+  //variables that can be queried by main program:
+  unsigned long duration; ///<Duration value of the timer in clock ticks
+  unsigned long elapsed;  ///<Elapsed time, in clock ticks, that the timer has been counting
+  bool TMR;               ///<Status bit of timer; true if elapsed time is greater than, or equal to, the duration value
+
+private:
+  //starttime not needed by main program
+  unsigned long startTime;
+  //no real need for the states to be known by main program
+  bool state_Waiting;
+  bool state_Timing;
+};
+
+/*!
+   @brief   This function runs when you "construct" a hardware timer
+
+   @return  FSMHardwareTimer object.
+   @param   _duration (unsigned long) sets the duration of the timer in clock ticks
+ */
+template<uint8_t TimerNum>
+FSMHardwareTimer<TimerNum>::FSMHardwareTimer(unsigned long _duration)
+{
+  duration = _duration;
+  state_Waiting = true;
+  state_Timing = false;
+  startTime = 0;//the clock may not be running yet, update() sets the start time
+  elapsed = 0;
+  TMR = false;
+}
+
+/*!
+   @brief   This function updates the timer based on the enable input.
+
+   If enable is true the timer checks to see if the elapsed time is greater than the preset duration and sets the
+   TMR value<br>
+   If enable is false the timer resets
+
+   @return  nothing
+
+   @param   enable (bool) a turns the timer on or off
+ */
+template<uint8_t TimerNum>
+void FSMHardwareTimer<TimerNum>::update(bool enable)
+{
+  //fast path: a disabled timer that is already waiting, or an expired timer that is still
+  //enabled, does not change, so the clock is not read
+  if (state_Waiting && !enable) {
+    elapsed = 0;
+    TMR = (duration == 0);
+    return;
+  }
+  if (state_Timing && enable && TMR) return;
+
+  //Block 2: State Transition Logic.
+  bool waitToTime = state_Waiting && enable;
+  bool waitToWait = state_Waiting && !enable;
+  bool timeToWait = state_Timing && !enable;
+  bool timeToTime = state_Timing && enable;
+
+  //Block 3: Update States
+  state_Waiting = timeToWait || waitToWait;
+  state_Timing = waitToTime || timeToTime;
+
+  //Block 4: outputs and old variables
+  unsigned long curTime = FSMHardwareClock<TimerNum>::ticks();
+  if (state_Waiting || waitToTime) {
+    startTime = curTime;  //timing starts on the scan the timer is enabled
+  }
+  elapsed = curTime - startTime;
+  TMR = (elapsed >= duration);
+}
+
+/*!
+ @brief  This class impliments a callback that runs from a hardware interrupt at an exact time
+
+ The FSMCallbackTimer class calls a user function from the compare A interrupt of the timer running
+ FSMHardwareClock<TimerNum>, either once (startOnce) or at a fixed rate (startPeriodic), without waiting
+ for loop() to get around to it. All running callback timers on a clock are kept in one list sorted by
+ deadline, and the compare register is always set to the earliest one.
+
+ Callbacks run with interrupts disabled, so they should only do a few things such as writing a pin or
+ setting a flag for the FSM; Serial and delay() must not be used in them. Periodic callbacks are scheduled
+ one period after the previous deadline, so their average rate is exact.
+ FSMHardwareClock<TimerNum>::begin() must be called in setup() before a callback timer is started.
+*/
+template<uint8_t TimerNum>
+class FSMCallbackTimer
+{
+public:
+  FSMCallbackTimer(void (*_callback)());
+  ~FSMCallbackTimer(void) { stop(); }
+
+  //runs the callback once, delayTicks clock ticks from now
+  void startOnce(unsigned long delayTicks);
+  //runs the callback every periodTicks clock ticks, starting one period from now
+  void startPeriodic(unsigned long periodTicks);
+  //cancels the callback if it has not run yet
+  void stop();
+
+  //runs the callbacks that are due and sets up the compare interrupt for the next one
+  static void dispatch();
+
+  volatile bool active;   ///<True while the callback is scheduled
+
+private:
+  void schedule(unsigned long delayTicks, unsigned long periodTicks);
+  void insert();
+  void remove();
+
+  void (*callback)();
+  unsigned long deadline;
+  unsigned long period;
+  FSMCallbackTimer *next;
+
+  static FSMCallbackTimer *head;  //earliest deadline first
+};
+
+template<uint8_t TimerNum> FSMCallbackTimer<TimerNum> *FSMCallbackTimer<TimerNum>::head = 0;
+
+/*!
+   @brief   This function runs when you "construct" a callback timer
+
+   @param   _callback (void function) the function that is run when the timer expires
+ */
+template<uint8_t TimerNum>
+FSMCallbackTimer<TimerNum>::FSMCallbackTimer(void (*_callback)())
+{
+  callback = _callback;
+  deadline = 0;
+  period = 0;
+  next = 0;
+  active = false;
+}
+
+/*!
+   @brief   Runs the callback once after the given delay. A timer that is already running is restarted.
+
+   @param   delayTicks (unsigned long) delay in clock ticks, see FSMHardwareClock::microsToTicks
+ */
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::startOnce(unsigned long delayTicks)
+{
+  schedule(delayTicks, 0);
+}
+
+/*!
+   @brief   Runs the callback at a fixed rate. A timer that is already running is restarted.
+
+   @param   periodTicks (unsigned long) period in clock ticks, see FSMHardwareClock::microsToTicks
+ */
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::startPeriodic(unsigned long periodTicks)
+{
+  schedule(periodTicks, periodTicks);
+}
+
+/*!
+   @brief   Cancels the callback. Does nothing if the timer is not running.
+ */
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::stop()
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if (active) remove();
+  SREG = oldSREG;
+}
+
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::schedule(unsigned long delayTicks, unsigned long periodTicks)
+{
+  uint8_t oldSREG = SREG;
+  cli();
+  if (active) remove();
+  deadline = FSMHardwareClock<TimerNum>::ticks() + delayTicks;
+  period = periodTicks;
+  insert();
+  if (head == this) dispatch();  //the compare register has to move to the new earliest deadline
+  SREG = oldSREG;
+}
+
+//must be called with interrupts disabled
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::insert()
+{
+  FSMCallbackTimer **link = &head;
+  while (*link && (long)((*link)->deadline - deadline) <= 0) link = &(*link)->next;
+  next = *link;
+  *link = this;
+  active = true;
+}
+
+//must be called with interrupts disabled
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::remove()
+{
+  FSMCallbackTimer **link = &head;
+  while (*link && *link != this) link = &(*link)->next;
+  if (*link) *link = next;
+  next = 0;
+  active = false;
+}
+
+/*!
+   @brief   Runs every callback whose deadline has passed and arms the compare interrupt for the next one
+
+   Called from the compare A interrupt of the clock's timer, and with interrupts disabled when a timer is started.
+   Deadlines more than one 16-bit wrap away simply cause an early interrupt that re-arms the same compare value.
+ */
+template<uint8_t TimerNum>
+void FSMCallbackTimer<TimerNum>::dispatch()
+{
+  typedef FSMTimerRegs<TimerNum> R;
+  for (;;) {
+    FSMCallbackTimer *t = head;
+    if (!t) {
+      R::timsk() &= ~_BV(R::OCIEA);
+      return;
+    }
+    if ((long)(t->deadline - FSMHardwareClock<TimerNum>::ticks()) > 0) {
+      R::ocra() = (uint16_t)t->deadline;
+      R::tifr() = _BV(R::OCFA);
+      R::timsk() |= _BV(R::OCIEA);
+      //if the count passed the compare value while it was being written, run the callback now
+      if ((long)(t->deadline - FSMHardwareClock<TimerNum>::ticks()) > 0) return;
+      continue;
+    }
+    head = t->next;
+    t->next = 0;
+    if (t->period) {
+      t->deadline += t->period;
+      t->insert();
+    }
+    else {
+      t->active = false;
+    }
+    t->callback();
+  }
+}
+
+/*!
+ @brief  This class impliments a counter of pulses on a timer's external clock pin
+
+ The HardwarePulseCounter class clocks the 16-bit timer TimerNum from its Tn input pin, so every rising
+ edge is counted by the hardware however short it is and however long loop() takes, with no CPU time per
+ pulse. The count is extended to 32 bits by FSMHardwareClock's overflow interrupt, which runs once every
+ 65536 pulses. update() reads the count into the same preset/count/CNT outputs as RisingEdgeCounter.
+ Only T5 (pin 47) is brought out on the Arduino Mega; T1, T3 and T4 are not connected to header pins.
+ begin() must be called in setup(). The timer cannot be used for PWM or as a clock at the same time.
+*/
+template<uint8_t TimerNum>
+class HardwarePulseCounter
+{   //public functions and variables that can be accessed by user
+public:
+  HardwarePulseCounter(unsigned long _preset); //add leading underscore to avoid confusing this for the class's "stored" preset
+
+  //starts counting edges on the Tn pin (FSM_HWCLOCK_EXT_RISING or FSM_HWCLOCK_EXT_FALLING)
+  void begin(uint8_t edge = FSM_HWCLOCK_EXT_RISING);
+
+  //function that runs the state machine
+  void update(bool RST);
+
+  //variables that can be queried by main program:
+  unsigned long preset;  ///<Sets/returns the number of counts that will trip the state of counting variable
+  unsigned long count;   ///<Returns the number of pulses since the last reset
+  bool CNT;              ///<Status bit of counter; true if the number of counts is greater than, or equal to, the preset value
+
+private:
+  unsigned long base;    //hardware count at the last reset
+};
+
+/*!
+   @brief   This function runs when you "construct" a hardware pulse counter
+
+   @param   _preset (unsigned long) Sets the preset count when the state of the counter changes
+ */
+template<uint8_t TimerNum>
+HardwarePulseCounter<TimerNum>::HardwarePulseCounter(unsigned long _preset)
+{
+  preset = _preset;
+  count = 0;
+  base = 0;
+  CNT = (count >= preset);
+}
+
+/*!
+   @brief   Starts the timer counting pulses on its Tn pin
+
+   @param   edge (uint8_t) FSM_HWCLOCK_EXT_RISING or FSM_HWCLOCK_EXT_FALLING
+ */
+template<uint8_t TimerNum>
+void HardwarePulseCounter<TimerNum>::begin(uint8_t edge)
+{
+  FSMHardwareClock<TimerNum>::begin(edge);
+  base = 0;
+  count = 0;
+}
+
+/*!
+   @brief   This function reads the hardware count
+
+   If RST is true the count is set back to 0. This does not need a transition change.
+
+   @return  nothing
+
+   @param   RST (bool) true will reset the counter to 0
+ */
+template<uint8_t TimerNum>
+void HardwarePulseCounter<TimerNum>::update(bool RST)
+{
+  unsigned long pulses = FSMHardwareClock<TimerNum>::ticks();
+  if (RST) base = pulses;
+  count = pulses - base;
+  CNT = (count >= preset);
+}
+
+//bit mask and port of a list of pins, for EdgeDetector
+template<uint8_t... Pins> struct FSMPinList;
+template<uint8_t Pin> struct FSMPinList<Pin>
+{
+  static const uint8_t port = fsmPinPort(Pin);
+  static const uint8_t mask = fsmPinMask(Pin);
+  static const bool samePort = true;
+};
+template<uint8_t Pin, uint8_t... Rest> struct FSMPinList<Pin, Rest...>
+{
+  static const uint8_t port = fsmPinPort(Pin);
+  static const uint8_t mask = fsmPinMask(Pin) | FSMPinList<Rest...>::mask;
+  static const bool samePort = (port == FSMPinList<Rest...>::port) && FSMPinList<Rest...>::samePort;
+};
+
+/*!
+ @brief  This class impliments an edge detector for a group of pins on one port
+
+ The EdgeDetector class finds the rising and falling edges of all of its Pins (Arduino Mega pin numbers,
+ which must all be on the same port) with a single read of the port's PINx register per update. This
+ replaces one digitalRead() per input, and every input is sampled at the same instant. The pin numbers
+ are turned into the port and bit mask at compile time.
+
+ The levels and edges are bit masks in port bit order; maskOf(pin) gives the bit of a pin, and rose(pin),
+ fell(pin) and read(pin) test one pin. The first update only reads the levels and reports no edges.
+*/
+template<uint8_t... Pins>
+class EdgeDetector
+{   //public functions and variables that can be accessed by user
+public:
+  static_assert(sizeof...(Pins) > 0, "EdgeDetector needs at least one pin");
+  static_assert(FSMPinList<Pins...>::samePort, "EdgeDetector pins must all be on the same port");
+
+  static const uint8_t PORT = FSMPinList<Pins...>::port;  ///<Port of the pins, see fsmPinPort()
+  static const uint8_t MASK = FSMPinList<Pins...>::mask;  ///<Port bits of all of the pins
+
+  EdgeDetector();
+
+  //function that reads the port and finds the edges
+  void update();
+
+  static constexpr uint8_t maskOf(uint8_t pin) { return fsmPinPort(pin) == PORT ? fsmPinMask(pin) : 0; }
+  bool rose(uint8_t pin) const { return rising & maskOf(pin); }
+  bool fell(uint8_t pin) const { return falling & maskOf(pin); }
+  bool read(uint8_t pin) const { return level & maskOf(pin); }
+
+  //variables that can be queried by main program:
+  uint8_t level;    ///<Value of the pins at the last update
+  uint8_t rising;   ///<Pins that went from false to true at the last update
+  uint8_t falling;  ///<Pins that went from true to false at the last update
+
+private:
+  bool started;
+};
+
+/*!
+   @brief   This function runs when you "construct" an edge detector
+
+   The pins are not read until the first update, since pinMode() runs in setup().
+ */
+template<uint8_t... Pins>
+EdgeDetector<Pins...>::EdgeDetector()
+{
+  level = 0;
+  rising = 0;
+  falling = 0;
+  started = false;
+}
+
+/*!
+   @brief   This function reads the port once and updates the levels and edges of all of the pins
+
+   @return  nothing
+ */
+template<uint8_t... Pins>
+void EdgeDetector<Pins...>::update()
+{
+  uint8_t in = FSMPortRegs<PORT>::pin() & MASK;
+  uint8_t changed = started ? (uint8_t)(in ^ level) : 0;
+  rising = changed & in;
+  falling = changed & level;
+  level = in;
+  started = true;
+}
+
+#endif //FSM_HAS_TIMER16
+
+/*!
+ @brief  This class impliments a counter of pulses on an external interrupt pin
+
+ The InterruptPulseCounter class counts rising edges on Pin (2, 3, 18, 19, 20 or 21 on the Arduino Mega)
+ from an external interrupt, so pulses shorter than one scan of loop() are not lost. Each pulse costs one
+ short interrupt. update() reads the count into the same preset/count/CNT outputs as RisingEdgeCounter.
+ begin() must be called in setup(). Pins 2, 3, 20 and 21 are used by FSMEncoder1 and FSMEncoder2.
+*/
+template<uint8_t Pin>
+class InterruptPulseCounter
+{   //public functions and variables that can be accessed by user
+public:
+  InterruptPulseCounter(unsigned long _preset); //add leading underscore to avoid confusing this for the class's "stored" preset
+
+  //attaches the interrupt; mode is RISING, FALLING or CHANGE
+  void begin(int mode = RISING);
+
+  //function that runs the state machine
+  void update(bool RST);
+
+  //variables that can be queried by main program:
+  unsigned long preset;  ///<Sets/returns the number of counts that will trip the state of counting variable
+  unsigned long count;   ///<Returns the number of pulses since the last reset
+  bool CNT;              ///<Status bit of counter; true if the number of counts is greater than, or equal to, the preset value
+
+private:
+  static void pulseISR() { pulses++; }
+  static volatile unsigned long pulses;
+  unsigned long base;    //interrupt count at the last reset
+};
+
+template<uint8_t Pin> volatile unsigned long InterruptPulseCounter<Pin>::pulses = 0;
+
+/*!
+   @brief   This function runs when you "construct" an interrupt pulse counter
+
+   @param   _preset (unsigned long) Sets the preset count when the state of the counter changes
+ */
+template<uint8_t Pin>
+InterruptPulseCounter<Pin>::InterruptPulseCounter(unsigned long _preset)
+{
+  preset = _preset;
+  count = 0;
+  base = 0;
+  CNT = (count >= preset);
+}
+
+/*!
+   @brief   Sets the pin as an input and attaches the counting interrupt
+
+   @param   mode (int) RISING, FALLING or CHANGE
+ */
+template<uint8_t Pin>
+void InterruptPulseCounter<Pin>::begin(int mode)
+{
+  pinMode(Pin, INPUT);
+  attachInterrupt(digitalPinToInterrupt(Pin), pulseISR, mode);
+}
+
+/*!
+   @brief   This function reads the interrupt count
+
+   If RST is true the count is set back to 0. This does not need a transition change.
+
+   @return  nothing
+
+   @param   RST (bool) true will reset the counter to 0
+ */
+template<uint8_t Pin>
+void InterruptPulseCounter<Pin>::update(bool RST)
+{
+  noInterrupts();
+  unsigned long current = pulses;
+  interrupts();
+  if (RST) base = current;
+  count = current - base;
+  CNT = (count >= preset);
+}
+
+/*!
+ @brief  This class impliments a quadrature based encoder attached to the Motor1 connector
+
+The FSMEncoder1 class supports a quadrature based encoder attached to the Motor1 connector.
+The number of counts can be accessed through the getCounts and getCountsAndReset functions.
+*/
+class FSMEncoder1
+{//public functions and variables that can be accessed by user
+public:
+  // Constructor/destructor:
+  //must declare the class itself as public
+  FSMEncoder1(); //which motor control socket is being used
+  ~FSMEncoder1(void);
+
+  //Returns the current number of encoder counts
+  long getCounts();
+
+  //Returns the current number of encoder counts and resets the counts to 0
+  long getCountsAndReset();
+
+//private variables are ones that can't be accessed by main program
+    //note that these variables only exists in the FSMFastTimer class so
+    //duplicate names in other classes do not create a conflict
+private: 
+  bool initialized = false;       //has the system been initialized?
+
+  static void Encoder1AISR();
+  static void Encoder1BISR();
+
+};
+
+/*!
+ @brief  This class impliments a quadrature based encoder attached to the Motor2 connector
+
+The FSMEncoder2 class supports a quadrature based encoder attached to the Motor1 connector.
+The number of counts can be accessed through the getCounts and getCountsAndReset functions.
+The velocity can be calculated using the get2CountDeltaT function that returns the amount of
+time, in microseconds, while the sensor moved two counts.
+*/
+class FSMEncoder2
+{//public functions and variables that can be accessed by user
+public:
+  // Constructor/destructor:
+  //must declare the class itself as public
+  FSMEncoder2(); //which motor control socket is being used
+  ~FSMEncoder2(void);
+
+
+  //Returns the current number of encoder counts
+  long getCounts();
+
+  //Returns the current number of encoder counts and resets the counts to 0
+  long getCountsAndReset();
+
+  //private variables are ones that can't be accessed by main program
+      //note that these variables only exists in the FSMFastTimer class so
+      //duplicate names in other classes do not create a conflict
+private:
+  bool initialized = false;       //has the system been initialized?
+
+  static void Encoder2AISR();
+  static void Encoder2BISR();
+
+
+};
+
+
+
+#ifdef FSM_HAS_TIMER16
+
+//timer TOP for phase correct PWM at f Hz from the undivided clock, limited to 16 bits
+constexpr uint16_t fsmPwmTop(unsigned long f)
+{
+  return (f == 0 || F_CPU / (2 * f) > 65535UL) ? 65535 : (F_CPU / (2 * f) < 2 ? 2 : (uint16_t)(F_CPU / (2 * f)));
+}
+
+#ifndef FSM_MOTOR1_IN1_PIN
+#define FSM_MOTOR1_IN1_PIN 11  ///<Motor 1 connector input 1 (OC1A), can be defined before including ME480FSM.h
+#endif
+#ifndef FSM_MOTOR1_IN2_PIN
+#define FSM_MOTOR1_IN2_PIN 12  ///<Motor 1 connector input 2 (OC1B), can be defined before including ME480FSM.h
+#endif
+#define FSM_MOTOR2_IN1_PIN 6   ///<Motor 2 connector input 1 (OC4A)
+#define FSM_MOTOR2_IN2_PIN 8   ///<Motor 2 connector input 2 (OC4C)
+
+#define FSM_COMP_POINTS 17     ///<Number of points in an FSMMotor compensation table
+
+//PWM decay modes of FSMMotor
+#define FSM_DECAY_SLOW 0       ///<Drive/brake PWM: one input high, the other PWM (default)
+#define FSM_DECAY_FAST 1       ///<Drive/coast PWM: one input low, the other PWM
+
+/*!
+ @brief  This class runs a function from a 16-bit timer's overflow interrupt, once every few PWM periods
+
+ In phase correct PWM the overflow interrupt comes once per PWM period, when the timer is at BOTTOM, half a
+ period before the compare registers are loaded at TOP. A function run from it therefore samples and
+ updates the motor at the same point of every PWM period. FSMMotor::attachTick uses it for the motor's timer.
+ The function runs with interrupts off, so it must be short, and variables it shares with loop() must be
+ volatile. The overflow interrupt of a timer cannot be shared with FSMHardwareClock on the same timer.
+
+ The same interrupt dithers one compare register for FSMMotor::setVoltageDithered: a first-order sigma-delta
+ accumulator adds the 8-bit fraction of the duty cycle every period and writes ditherBase, or ditherBase + 1
+ when it carries, so the average duty cycle has 8 more bits than the timer.
+*/
+template<uint8_t TimerNum>
+struct FSMPwmTick
+{
+  static void (*volatile callback)();  ///<Function run by the interrupt, or 0
+  static volatile uint8_t every;       ///<Number of PWM periods between calls
+  static volatile uint8_t countdown;   ///<PWM periods left until the next call
+
+  static volatile bool dithering;      ///<Is a compare register being dithered?
+  static volatile uint8_t ditherChannel;  ///<Compare channel being dithered (0 = A, 1 = B, 2 = C)
+  static volatile uint16_t ditherBase; ///<Whole part of the dithered compare value
+  static volatile uint8_t ditherFrac;  ///<Fraction of the dithered compare value, in 1/256
+  static uint8_t ditherAcc;            ///<Sigma-delta accumulator
+
+  //called by the overflow interrupt
+  static void dispatch()
+  {
+    if (dithering) {
+      uint16_t acc = ditherAcc + ditherFrac;
+      ditherAcc = (uint8_t)acc;
+      FSMTimerRegs<TimerNum>::ocr(ditherChannel) = ditherBase + (acc >> 8);
+    }
+    if (--countdown == 0) {
+      countdown = every;
+      if (callback) callback();
+    }
+  }
+};
+
+//defined in FSMPwmTick1/3/4/5.cpp, next to the interrupts
+template<> void (*volatile FSMPwmTick<1>::callback)();
+template<> void (*volatile FSMPwmTick<3>::callback)();
+template<> void (*volatile FSMPwmTick<4>::callback)();
+template<> void (*volatile FSMPwmTick<5>::callback)();
+template<> volatile uint16_t FSMPwmTick<1>::ditherBase;
+template<> volatile uint16_t FSMPwmTick<3>::ditherBase;
+template<> volatile uint16_t FSMPwmTick<4>::ditherBase;
+template<> volatile uint16_t FSMPwmTick<5>::ditherBase;
+
+template<uint8_t TimerNum> volatile uint8_t FSMPwmTick<TimerNum>::every = 1;
+template<uint8_t TimerNum> volatile uint8_t FSMPwmTick<TimerNum>::countdown = 1;
+template<uint8_t TimerNum> volatile bool FSMPwmTick<TimerNum>::dithering = false;
+template<uint8_t TimerNum> volatile uint8_t FSMPwmTick<TimerNum>::ditherChannel = 0;
+template<uint8_t TimerNum> volatile uint8_t FSMPwmTick<TimerNum>::ditherFrac = 0;
+template<uint8_t TimerNum> uint8_t FSMPwmTick<TimerNum>::ditherAcc = 0;
+
+#define FSM_SUPPLY_MIN_MV 1000  ///<Lowest supply voltage used by FSMSupplySense for the reciprocal, in millivolts
+
+/*!
+ @brief  This class impliments a background measurement of the motor supply voltage
+
+ The FSMSupplySense class measures the motor supply through a voltage divider on an analog pin. update() is
+ called every scan and never waits for the ADC: it starts a conversion every samplePeriod milliseconds and
+ collects the result on a later scan, when the conversion (about 104us) has finished. With each sample it
+ works out millivolts and a fixed point reciprocal of it, so FSMMotor::setVoltageMillivolts can turn
+ millivolts into a duty cycle with a multiplication instead of a division.
+ A conversion that an analogRead() of another pin has replaced is detected and started again, but analogRead()
+ should still not be called while BUSY is true, since it would wait for and return the supply conversion.
+ Until the first sample, millivolts is 0 and the motor voltage is 0.
+*/
+class FSMSupplySense
+{   //public functions and variables that can be accessed by user
+public:
+  FSMSupplySense(uint8_t _pin, unsigned int _fullScaleMillivolts, unsigned long _samplePeriod = 10);
+
+  //function that runs the state machine
+  void update();
+
+  //variables that can be queried by main program:
+  unsigned int millivolts;  ///<Supply voltage at the last sample, in millivolts
+  unsigned int recipQ10;    ///<32767 * 1024 / millivolts (limited to FSM_SUPPLY_MIN_MV); 0 until the first sample
+  bool BUSY;                ///<Status bit; true while a conversion is running
+
+private:
+  uint8_t pin;                  //ADC channel, 0 to 15
+  unsigned long mvPerCountQ16;  //millivolts per ADC count, 16.16 fixed point
+  unsigned long samplePeriod;
+  unsigned long lastSample;
+};
+
+/*!
+ @brief  This class impliments a motor driven by a DRV8837 on any two PWM pins of one 16-bit timer
+
+The FSMMotor class supports running a motor with the DRV8837 motor driver whose inputs are connected to
+the pins In1 and In2. This class uses the a pin configuration that minimizes non-linearities in the driver.
+The pins must both be outputs of the same 16-bit timer (Timer1: 11, 12; Timer3: 2, 3, 5; Timer4: 6, 7, 8;
+Timer5: 44, 45, 46); the timer and compare registers are found by the compiler, and using other pins is a
+compile error. FSMMotor1 and FSMMotor2 are the motors on the MicroRig connectors.
+The voltage of the motor can be set between -255 and 255 counts, corresponding with duty cycles between 0 and 100% in each direction. Positive voltages turn the motor
+in the same direction as positive encoder counts.
+The current motor voltage can be accessed through the curVoltage variable.
+setVoltage writes the compare registers of the two pins directly, and only when the command changes.
+
+By default the timer keeps the Arduino setting of 8-bit phase correct PWM at about 490Hz, which can be heard and
+gives a lot of current ripple. Constructing the motor with a frequency, for example FSMMotor2 motor(20000);,
+runs the timer in phase correct PWM with TOP = F_CPU / (2 * frequency) in ICR and no prescaler, so any
+frequency from 123Hz up can be used (20kHz gives TOP = 400). TOP is worked out by the compiler when the
+frequency is a constant, and the timer is set up by the first call to setVoltage. Only the motor's timer is
+changed, so millis() and micros() (Timer0) are not affected, but the timer's other PWM pin then also runs at
+the new frequency.
+setVoltageQ15 sets the voltage with the full TOP + 1 step resolution of the timer.
+
+The driver deadband and static friction can be compensated with setCompensation, which maps the commanded
+voltage to the applied voltage through a table of FSM_COMP_POINTS points (in RAM or PROGMEM). Point k is the
+applied voltage in counts for a command of k/16 of full voltage, and commands in between are interpolated, so
+the map costs one table lookup and two multiplications per call. calibrate fills a table with the encoder.
+
+For a slew rate limited voltage, set the rate with setSlewRate and the goal with setTarget, and call updateRamp
+every scan. The ramp is worked out from the time since the last call, not the number of calls, so it is as
+smooth with a jittery loop() as with a steady one, and it moves in steps finer than one count. updateRamp
+returns straight away once the target is reached.
+
+attachTick runs a control function from the timer's overflow interrupt every N PWM periods (see FSMPwmTick),
+so the voltage is updated at the same point of the PWM cycle with a fixed delay, instead of whenever loop()
+gets to it. The function may call setVoltage, setVoltageQ15 or updateRamp.
+
+setVoltageDithered raises the resolution without lowering the PWM frequency: the fraction of the duty cycle
+below one timer step is spread over successive PWM periods by the overflow interrupt (see FSMPwmTick), at a
+cost of a few cycles per period. It stops when setVoltage or setVoltageQ15 is called.
+
+setDecayMode chooses what the driver does in the off part of each PWM period. In slow decay (FSM_DECAY_SLOW,
+the default) one input is held high and the other is PWM, so the motor is braked between pulses; the speed is
+close to proportional to the voltage and the motor slows down quickly. In fast decay (FSM_DECAY_FAST) one
+input is held low and the other is PWM, so the motor coasts between pulses. brake() and coast() stop the
+motor by shorting its terminals or leaving them open.
+
+With an FSMSupplySense attached by setSupplySense, setVoltageMillivolts takes the voltage in millivolts and
+scales it by the measured supply, so the applied voltage stays the same when the supply sags.
+
+This class does not control the relay on the MicroRig board.
+*/
+template<uint8_t In1, uint8_t In2>
+class FSMMotor
+{//public functions and variables that can be accessed by user
+public:
+  static const uint8_t TIMER = fsmPwmTimer(In1);  ///<16-bit timer driving the motor pins
+  static_assert(TIMER != 0, "FSMMotor pins must be PWM outputs of Timer1, 3, 4 or 5");
+  static_assert(fsmPwmTimer(In2) == TIMER, "FSMMotor pins must be outputs of the same timer");
+
+  // Constructor/destructor:
+  //must declare the class itself as public
+  FSMMotor();
+  //phase correct PWM at pwmFrequency Hz
+  FSMMotor(unsigned long pwmFrequency) : FSMMotor() { setTop(fsmPwmTop(pwmFrequency)); }
+  ~FSMMotor(void);
+
+  //set the voltage of the motor 
+  void setVoltage(int voltageCounts);
+  //set the voltage of the motor as a Q15 fraction of full voltage, with the resolution of the timer's TOP
+  void setVoltageQ15(int16_t voltageQ15);
+  //set the voltage of the motor as a Q15 fraction of full voltage, dithering the duty cycle for 8 more bits
+  void setVoltageDithered(int16_t voltageQ15);
+  //chooses the PWM decay mode, FSM_DECAY_SLOW or FSM_DECAY_FAST
+  void setDecayMode(uint8_t mode);
+  //stops the motor with both inputs high (terminals shorted) or both low (terminals open)
+  void brake();
+  void coast();
+  //set the voltage of the motor in millivolts, using the supply measured by an FSMSupplySense
+  void setSupplySense(FSMSupplySense *_supply) { supply = _supply; }
+  void setVoltageMillivolts(int millivolts);
+
+  //maps commanded to applied voltage through a table of FSM_COMP_POINTS counts, or stops compensating if table is 0
+  void setCompensation(const uint8_t *table, bool inProgmem = false);
+  //measures the motor with an encoder (FSMEncoder1 or FSMEncoder2), fills table and compensates with it
+  template<class Encoder>
+  bool calibrate(Encoder &encoder, uint8_t *table, unsigned int settleTime = 500, unsigned int measureTime = 250);
+
+  //slew rate limited voltage: the voltage ramps toward the target at the slew rate while updateRamp is called
+  void setTarget(int voltageCounts);
+  void setSlewRate(unsigned int countsPerSecond);
+  void updateRamp();
+
+  //runs callback from the timer's overflow interrupt once every everyPeriods PWM periods
+  void attachTick(void (*callback)(), uint8_t everyPeriods = 1);
+  void detachTick();
+
+  //variables that can be queried by main program:
+  int curVoltageCounts; ///<current voltage set for the motor
+  int targetVoltageCounts = 0;  ///<voltage that updateRamp is ramping toward
+
+  //private variables are ones that can't be accessed by main program
+      //note that these variables only exists in the FSMMotor class so
+      //duplicate names in other classes do not create a conflict
+private:
+  typedef FSMTimerRegs<TIMER> Regs;
+  static const uint8_t CH1 = fsmPwmChannel(In1);
+  static const uint8_t CH2 = fsmPwmChannel(In2);
+
+  bool initialized = false;       //has the system been initialized?
+  bool pwmAttached = false;       //are the outputs connected to the timer? (done by the first setVoltage)
+  bool icrTop = false;            //does the timer run with TOP in ICR instead of the Arduino setting?
+  bool rewrite = false;           //must setVoltage write an unchanged command? (after setVoltageQ15 or setCompensation)
+  uint16_t top = 255;             //timer TOP
+  unsigned long pwmScale = 65536; //compare value per count, 16.16 fixed point, rounded up so 255 counts give TOP
+  uint16_t dutyIn1;               //compare values last written for In1 and In2
+  uint16_t dutyIn2;
+  const uint8_t *compTable = 0;   //compensation table, or 0 when not compensating
+  bool ramping = false;           //is updateRamp moving the voltage toward the target?
+  bool tickAttached = false;      //is a function attached with attachTick?
+  uint8_t decay = FSM_DECAY_SLOW; //PWM decay mode
+  FSMSupplySense *supply = 0;     //supply measurement used by setVoltageMillivolts
+  bool dithered = false;          //is the overflow interrupt dithering one of the compare registers?
+  long rampQ8;                    //ramp voltage in counts, 24.8 fixed point
+  unsigned long rampTime;         //time of the last ramp step in microseconds
+  unsigned long slewQ = 0;        //slew rate in 1/256 counts per 4096us (counts per second * 1.048576), 0 for no limit
+  uint16_t slewRem;               //fraction of a ramp step carried to the next update, in 1/4096
+  bool compProgmem = false;       //is the compensation table in PROGMEM?
+
+  uint8_t compPoint(uint8_t k) { return compProgmem ? pgm_read_byte(compTable + k) : compTable[k]; }
+  uint16_t compensate(uint16_t mag15);
+  //compare value for a Q15 voltage magnitude; mag15 is scaled like in setVoltageDithered so 32767 gives the full TOP
+  uint16_t q15Duty(uint16_t mag15) { return top - (uint16_t)(((unsigned long)(mag15 + (mag15 >> 14)) * top + 16384) >> 15); }
+  void writeDuty(bool forward, uint16_t duty);
+  void writeCompare(uint16_t in1, uint16_t in2);
+  void setTop(uint16_t _top) { top = _top; pwmScale = (((unsigned long)_top << 16) + 254) / 255; icrTop = true; }
+
+};
+
+typedef FSMMotor<FSM_MOTOR1_IN1_PIN, FSM_MOTOR1_IN2_PIN> FSMMotor1;  ///<Motor on the motor 1 connector
+typedef FSMMotor<FSM_MOTOR2_IN1_PIN, FSM_MOTOR2_IN2_PIN> FSMMotor2;  ///<Motor on the motor 2 connector
+
+/*! @brief This is the constructor for the class.
+
+It will initialize the output pins and set the motor to 0 volts. This is called automatically
+when you declare the objectand will not need to be call in your program. You should not set the
+pinMode of the motor pins in your program.
+*/
+template<uint8_t In1, uint8_t In2>
+FSMMotor<In1, In2>::FSMMotor() {
+  {
+    if (!initialized) {
+
+      pinMode(In1, OUTPUT);
+      pinMode(In2, OUTPUT);
+
+      curVoltageCounts = 0;
+      analogWrite(In1, 255);
+      analogWrite(In2, 255);
+
+      initialized = true;
+    }
+  }
+}
+
+
+/*! @brief This is the destructor for the class.
+
+It will return the output pins of the motor to INPUT mode.
+*/
+template<uint8_t In1, uint8_t In2>
+FSMMotor<In1, In2>::~FSMMotor() {
+  {
+    if (initialized) {
+
+      analogWrite(In1, 0);
+      analogWrite(In2, 0);
+
+      pinMode(In1, INPUT);
+      pinMode(In2, INPUT);
+
+      curVoltageCounts = 0;
+      pwmAttached = false;
+      initialized = false;
+    }
+  }
+}
+
+/*! @brief This function sets the voltage sent to the motor.
+
+  The function accepts values between -255 and 255 counts corresponding with 0-100% duty cycle in the positive and negative directions. Any values lower
+  than -255 counts will be set to -255 counts and values higher than 255 counts will
+  be set to 255 counts. 
+  Positive values will turn the motor in the positive encoder direction, negative 
+  values will turn the motor in the negative encoder direction.
+  Calling it again with the same value does nothing, and only the compare register whose
+  duty cycle changes is written.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setVoltage(int voltageCounts) {
+  {
+    if (voltageCounts > 255) voltageCounts = 255;
+    if (voltageCounts < -255) voltageCounts = -255;
+
+    //a function attached with attachTick may also set the voltage, so the check and the write are not interrupted
+    uint8_t oldSREG = SREG;
+    cli();
+    //nothing to do if the command has not changed
+    if (pwmAttached && !rewrite && voltageCounts == curVoltageCounts) {
+      SREG = oldSREG;
+      return;
+    }
+
+    curVoltageCounts = voltageCounts;
+    rewrite = false;
+    if (compTable) {
+      //applied voltage from the compensation table, with the resolution of the timer
+      uint16_t mag = abs(voltageCounts);
+      writeDuty(voltageCounts > 0, q15Duty(compensate((mag * 257) >> 1)));
+    }
+    else {
+      uint8_t pwmVal = 255-abs(voltageCounts);
+      uint16_t duty = icrTop ? (uint16_t)((pwmVal * pwmScale) >> 16) : pwmVal;  //0 to 255 counts scaled to 0 to TOP
+      writeDuty(voltageCounts > 0, duty);
+    }
+    SREG = oldSREG;
+  }
+}
+
+/*! @brief This function sets the voltage sent to the motor with the full resolution of the timer.
+
+  The function accepts a Q15 fraction of the full voltage, between -32767 (-100%) and 32767 (100%), and
+  sets the duty cycle to the nearest of the TOP + 1 steps of the timer. With the default 8-bit PWM that
+  is the same 256 steps as setVoltage, so construct the motor with a PWM frequency to get more: at 16MHz
+  FSMMotor2 motor(7800) gives 10 bits (TOP = 1025) and FSMMotor2 motor(20000) gives 400 steps.
+  curVoltageCounts is set to the command in counts, rounded toward 0.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setVoltageQ15(int16_t voltageQ15) {
+  if (voltageQ15 < -32767) voltageQ15 = -32767;
+  uint16_t mag = (voltageQ15 < 0) ? -voltageQ15 : voltageQ15;
+
+  curVoltageCounts = (voltageQ15 < 0) ? -(int)(mag >> 7) : (int)(mag >> 7);
+  rewrite = true;
+  if (compTable) mag = compensate(mag);
+  writeDuty(voltageQ15 > 0, q15Duty(mag));
+}
+
+/*! @brief This function sets the voltage sent to the motor, dithering the duty cycle for finer resolution.
+
+  The function accepts a Q15 fraction of the full voltage like setVoltageQ15. The duty cycle is worked out to
+  1/256 of a timer step; the whole part is written to the compare register, and the timer's overflow interrupt
+  adds one step in the right fraction of the PWM periods with a first-order sigma-delta accumulator. With the
+  default 8-bit PWM this gives 16-bit average resolution at the same PWM frequency. Calling setVoltage or
+  setVoltageQ15 stops the dithering.
+
+  @param   voltageQ15 (int16_t) voltage between -32767 (-100%) and 32767 (100%)
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setVoltageDithered(int16_t voltageQ15) {
+  if (voltageQ15 < -32767) voltageQ15 = -32767;
+  uint16_t mag = (voltageQ15 < 0) ? -voltageQ15 : voltageQ15;
+
+  curVoltageCounts = (voltageQ15 < 0) ? -(int)(mag >> 7) : (int)(mag >> 7);
+  rewrite = true;
+  if (compTable) mag = compensate(mag);
+
+  //compare value in 1/256 steps; mag is scaled so 32767 gives the full TOP
+  unsigned long dutyQ8 = ((unsigned long)top << 8) - (((unsigned long)(mag + (mag >> 14)) * top) >> 7);
+  bool forward = voltageQ15 > 0;
+  uint16_t base = dutyQ8 >> 8;
+  uint8_t frac = dutyQ8 & 0xFF;
+  writeDuty(forward, base);  //also stops the last dithering
+  if (frac == 0) return;
+
+  //in fast decay the driven input gets TOP - duty, which is (TOP - base - 1) + (256 - frac) / 256
+  if (decay == FSM_DECAY_FAST) {
+    base = top - base - 1;
+    frac = -frac;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  FSMPwmTick<TIMER>::ditherChannel = (forward == (decay == FSM_DECAY_FAST)) ? CH1 : CH2;
+  FSMPwmTick<TIMER>::ditherBase = base;
+  FSMPwmTick<TIMER>::ditherFrac = frac;
+  FSMPwmTick<TIMER>::dithering = true;
+  if (!(Regs::timsk() & _BV(Regs::TOIE))) Regs::tifr() = _BV(Regs::TOV);  //clear an old overflow
+  Regs::timsk() |= _BV(Regs::TOIE);
+  dithered = true;
+  SREG = oldSREG;
+}
+
+/*! @brief This function chooses the PWM decay mode.
+
+  The current voltage is rewritten in the new mode by the next setVoltage, setVoltageQ15 or setVoltageDithered.
+
+  @param   mode (uint8_t) FSM_DECAY_SLOW (drive/brake, the default) or FSM_DECAY_FAST (drive/coast)
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setDecayMode(uint8_t mode) {
+  decay = mode;
+  rewrite = true;
+}
+
+/*! @brief This function brakes the motor by holding both inputs high, which shorts the motor terminals.
+
+  curVoltageCounts is set to 0 and a running ramp is stopped.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::brake() {
+  curVoltageCounts = 0;
+  ramping = false;
+  rewrite = true;
+  writeCompare(top, top);
+}
+
+/*! @brief This function lets the motor coast by holding both inputs low, which leaves the motor terminals open.
+
+  curVoltageCounts is set to 0 and a running ramp is stopped.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::coast() {
+  curVoltageCounts = 0;
+  ramping = false;
+  rewrite = true;
+  writeCompare(0, 0);
+}
+
+/*! @brief This function sets the voltage sent to the motor in millivolts.
+
+  The voltage is divided by the supply voltage measured by the FSMSupplySense given to setSupplySense, using
+  the reciprocal it worked out with its last sample, and set with setVoltageQ15. Voltages above the supply are
+  limited to 100%. Without a supply measurement the motor is set to 0.
+
+  @param   millivolts (int) voltage in millivolts; negative values turn the motor in the negative direction
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setVoltageMillivolts(int millivolts) {
+  long q15 = supply ? ((long)millivolts * supply->recipQ10) >> 10 : 0;
+  setVoltageQ15((int16_t)constrain(q15, -32767L, 32767L));
+}
+
+/*! @brief This function sets the voltage that updateRamp ramps toward.
+
+  If the motor is not already ramping, the ramp starts from curVoltageCounts.
+
+  @param   voltageCounts (int) target voltage between -255 and 255 counts
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setTarget(int voltageCounts) {
+  targetVoltageCounts = constrain(voltageCounts, -255, 255);
+  if (!ramping) {
+    rampQ8 = (long)curVoltageCounts << 8;
+    rampTime = micros();
+    slewRem = 0;
+    ramping = true;
+  }
+}
+
+/*! @brief This function sets the slew rate of the voltage ramp.
+
+  @param   countsPerSecond (unsigned int) largest change of the voltage, in counts per second, or 0 to jump
+           straight to the target
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setSlewRate(unsigned int countsPerSecond) {
+  //1048576 / 1000000 = 16384 / 15625
+  slewQ = ((unsigned long)countsPerSecond * 16384 + 7812) / 15625;
+  if (countsPerSecond > 0 && slewQ == 0) slewQ = 1;
+}
+
+/*! @brief This function moves the voltage toward the target by the slew rate times the time since the last call.
+
+  It should be called every scan. It does nothing once the target has been reached.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::updateRamp() {
+  if (!ramping) return;
+
+  long targetQ8 = (long)targetVoltageCounts << 8;
+  if (slewQ == 0) {
+    rampQ8 = targetQ8;
+  }
+  else {
+    unsigned long curTime = micros();
+    unsigned long dt = curTime - rampTime;
+    rampTime = curTime;
+    //step in 1/256 counts, at most 32768us at a time so the product fits in 32 bits
+    long step = 0;
+    while (dt > 0 && step < 0x10000L) {
+      unsigned long chunk = (dt > 32768UL) ? 32768UL : dt;
+      unsigned long acc = chunk * slewQ + slewRem;
+      step += acc >> 12;
+      slewRem = acc & 0x0FFF;
+      dt -= chunk;
+    }
+    if (rampQ8 < targetQ8) rampQ8 = (targetQ8 - rampQ8 > step) ? rampQ8 + step : targetQ8;
+    else rampQ8 = (rampQ8 - targetQ8 > step) ? rampQ8 - step : targetQ8;
+  }
+  ramping = (rampQ8 != targetQ8);
+
+  //counts in 24.8 to Q15: times 257/512
+  setVoltageQ15((int16_t)((rampQ8 * 257) >> 9));
+}
+
+/*! @brief This function runs a function from the motor timer's overflow interrupt, once every everyPeriods PWM periods.
+
+  The timer is set up first if setVoltage has not been called yet. At 20kHz, attachTick(control, 20) runs
+  control every 1ms.
+
+  @param   callback (void (*)()) function to run; it runs with interrupts off
+  @param   everyPeriods (uint8_t) number of PWM periods between calls (1 to 255)
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::attachTick(void (*callback)(), uint8_t everyPeriods) {
+  if (!pwmAttached) {
+    rewrite = true;
+    setVoltage(curVoltageCounts);
+  }
+  if (everyPeriods == 0) everyPeriods = 1;
+  uint8_t oldSREG = SREG;
+  cli();
+  FSMPwmTick<TIMER>::callback = callback;
+  FSMPwmTick<TIMER>::every = everyPeriods;
+  FSMPwmTick<TIMER>::countdown = everyPeriods;
+  if (!(Regs::timsk() & _BV(Regs::TOIE))) Regs::tifr() = _BV(Regs::TOV);  //clear an old overflow
+  Regs::timsk() |= _BV(Regs::TOIE);
+  tickAttached = true;
+  SREG = oldSREG;
+}
+
+/*! @brief This function stops running the function given to attachTick.
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::detachTick() {
+  uint8_t oldSREG = SREG;
+  cli();
+  if (!dithered) Regs::timsk() &= ~_BV(Regs::TOIE);
+  FSMPwmTick<TIMER>::callback = 0;
+  tickAttached = false;
+  SREG = oldSREG;
+}
+
+/*! @brief This function sets the table that compensates the deadband and nonlinearity of the driver and motor.
+
+  table[k], for k from 0 to 16, is the voltage in counts (0 to 255) that is applied for a command of k/16 of
+  full voltage, in either direction; commands in between are interpolated. A command of 0 is always 0.
+  The table is not copied, so it must stay in memory (a global array) while it is used.
+
+  @param   table (const uint8_t *) FSM_COMP_POINTS applied voltages, or 0 to stop compensating
+  @param   inProgmem (bool) true if table is stored in PROGMEM
+*/
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::setCompensation(const uint8_t *table, bool inProgmem) {
+  compTable = table;
+  compProgmem = inProgmem;
+  rewrite = true;
+}
+
+//applied voltage for a commanded voltage magnitude, both Q15, from the compensation table
+template<uint8_t In1, uint8_t In2>
+uint16_t FSMMotor<In1, In2>::compensate(uint16_t mag15) {
+  if (mag15 == 0) return 0;
+  uint8_t k = mag15 >> 11;
+  int y0 = compPoint(k);
+  int y1 = compPoint(k + 1);
+  //interpolated counts times 2048, then times 257/4096 to go from counts to Q15
+  long y = ((long)y0 << 11) + (long)(y1 - y0) * (mag15 & 0x7FF);
+  return (uint16_t)((y * 257) >> 12);
+}
+
+/*! @brief This function measures the motor with its encoder and fills a compensation table.
+
+  The motor is run forward at 17 evenly spaced applied voltages. At each one it waits settleTime milliseconds
+  and counts the encoder for measureTime milliseconds. The table is then filled so that the speed becomes
+  proportional to the command: point k gets the applied voltage at which the motor ran at k/16 of its full
+  speed. The function blocks for about 17 * (settleTime + measureTime) milliseconds, so call it from setup()
+  with the motor free to turn. The motor is left at 0 volts and compensating with the new table.
+
+  @return  true if the table was filled, false if the encoder did not move (compensation is then unchanged)
+  @param   encoder (Encoder &) encoder of the motor, for example an FSMEncoder2
+  @param   table (uint8_t *) array of FSM_COMP_POINTS to fill, which must stay in memory while it is used
+  @param   settleTime (unsigned int) time in milliseconds for the speed to settle at each voltage
+  @param   measureTime (unsigned int) time in milliseconds the encoder is counted at each voltage
+*/
+template<uint8_t In1, uint8_t In2>
+template<class Encoder>
+bool FSMMotor<In1, In2>::calibrate(Encoder &encoder, uint8_t *table, unsigned int settleTime, unsigned int measureTime) {
+  const uint8_t *oldTable = compTable;
+  long speed[FSM_COMP_POINTS];
+  uint8_t applied[FSM_COMP_POINTS];
+
+  //measure the speed without compensation, keeping it from decreasing
+  compTable = 0;
+  for (uint8_t k = 0; k < FSM_COMP_POINTS; k++) {
+    applied[k] = (uint8_t)(((unsigned long)k * 4096 + 128) / 257);  //k/16 of full voltage in counts
+    setVoltage(applied[k]);
+    delay(settleTime);
+    encoder.getCountsAndReset();
+    delay(measureTime);
+    long counts = encoder.getCountsAndReset();  //abs() is a macro, so not called on the function
+    speed[k] = abs(counts);
+    if (k > 0 && speed[k] < speed[k - 1]) speed[k] = speed[k - 1];
+  }
+  compTable = oldTable;
+  setVoltage(0);
+  long fullSpeed = speed[FSM_COMP_POINTS - 1];
+  if (fullSpeed <= 0) return false;
+
+  //point k gets the applied voltage whose speed is k/16 of full speed
+  table[0] = 0;
+  uint8_t j = 0;
+  for (uint8_t k = 1; k < FSM_COMP_POINTS; k++) {
+    long target = fullSpeed * k / (FSM_COMP_POINTS - 1);
+    while (j < FSM_COMP_POINTS - 2 && speed[j + 1] < target) j++;
+    long span = speed[j + 1] - speed[j];
+    long a = applied[j + 1];
+    if (target <= speed[j]) a = applied[j];
+    else if (span > 0) a = applied[j] + ((long)(applied[j + 1] - applied[j]) * (target - speed[j]) + span / 2) / span;
+    table[k] = (uint8_t)constrain(a, 0, 255);
+  }
+  setCompensation(table);
+  return true;
+}
+
+//writes the compare registers of both pins for a duty cycle given in slow decay form (TOP is 0 volts, 0 is
+//full voltage): in slow decay In1 is held high when forward and In2 otherwise; in fast decay the other input
+//is held low and the driven input gets the inverted duty cycle
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::writeDuty(bool forward, uint16_t duty) {
+  if (decay == FSM_DECAY_FAST) {
+    uint16_t on = top - duty;
+    writeCompare(forward ? on : 0, forward ? 0 : on);
+  }
+  else {
+    writeCompare(forward ? top : duty, forward ? duty : top);
+  }
+}
+
+//writes the compare registers of In1 and In2 and sets up the timer the first time
+template<uint8_t In1, uint8_t In2>
+void FSMMotor<In1, In2>::writeCompare(uint16_t in1, uint16_t in2) {
+  //In phase correct PWM a compare value of TOP holds the output high and 0 holds it low,
+  //the same outputs that analogWrite gives for 255 and 0.
+  //The 16-bit registers share a TEMP byte with interrupts that use the other timers.
+  uint8_t oldSREG = SREG;
+  cli();
+  bool force = !pwmAttached || dithered;
+  if (dithered) {
+    //stop dithering; the interrupt may have left the register one step above the value in dutyIn1 or dutyIn2
+    FSMPwmTick<TIMER>::dithering = false;
+    if (!tickAttached) Regs::timsk() &= ~_BV(Regs::TOIE);
+    dithered = false;
+  }
+  if (!pwmAttached && icrTop) {
+    //phase correct PWM with TOP in ICR (mode 10) from the undivided clock
+    Regs::tccrb() = 0;
+    Regs::tccra() = _BV(Regs::WGM1);
+    Regs::icr() = top;
+    Regs::tcnt() = 0;
+    Regs::tccrb() = _BV(Regs::WGM3) | _BV(Regs::CS0);
+  }
+  if (force || in1 != dutyIn1) Regs::ocr(CH1) = in1;
+  if (force || in2 != dutyIn2) Regs::ocr(CH2) = in2;
+  //the cached values must match the registers before an interrupt can write them again
+  dutyIn1 = in1;
+  dutyIn2 = in2;
+
+  if (!pwmAttached) {
+    //connect both outputs to the timer (non-inverting) once, instead of on every analogWrite
+    Regs::tccra() |= fsmComBit(CH1) | fsmComBit(CH2);
+    pwmAttached = true;
+  }
+  SREG = oldSREG;
+}
+
+#endif //FSM_HAS_TIMER16
+#endif
\ No newline at end of file